@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# End-to-end time of one command line that holds N background
+# pipelines, '/bin/true & /bin/true & ...', from starting esh until it
+# exits.  esh launches all of them back to back; the scheduler's limit
+# on running jobs (see 'sched') may queue some, and the shell exits once
+# the last one was started.  The second run lifts that limit.
+#
+. "$(dirname "$0")/common.sh"
+
+N=${N:-100}
+line=$(awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) printf "/bin/true & " }')
+
+for engine in spawn fork server; do
+    report "$N background jobs, $engine" "$N" \
+        "$(elapsed "$ESH" -e "$engine" -c "$line")"
+    report "$N background jobs, $engine, no limit" "$N" \
+        "$(elapsed "$ESH" -e "$engine" -c "sched jobs 0; $line")"
+done
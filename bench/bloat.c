@@ -0,0 +1,31 @@
+/*
+ * A plug-in that makes esh large, for bench/launch.sh.
+ *
+ * It allocates $ESH_BLOAT_MB megabytes (default 512) and touches every
+ * page, as a long-running interactive shell with a big history and
+ * many plug-ins would have.  fork(2) has to copy the page tables of
+ * all of it; posix_spawn and the fork server do not.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../esh.h"
+
+static char *ballast;
+
+static bool
+init_plugin(struct esh_shell *shell)
+{
+    char *env = getenv("ESH_BLOAT_MB");
+    size_t size = (env ? atol(env) : 512) << 20;
+
+    ballast = malloc(size);
+    if (ballast != NULL)
+        memset(ballast, 1, size);
+    return true;
+}
+
+struct esh_plugin esh_module = {
+    .rank = 100,
+    .init = init_plugin,
+};
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Lines per second of a script of N lines of 'echo line >> file', with
+# the echo built into esh and with /bin/echo, which esh forks and
+# execs.  The same for true and printf.
+#
+. "$(dirname "$0")/common.sh"
+
+N=${N:-10000}
+script=$(mktemp)
+out=$(mktemp)
+trap 'rm -f "$script" "$out"' EXIT
+
+# run "$@" N times as a script, with a label
+run() {
+    label=$1
+    shift
+    CMD="$*" awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) print ENVIRON["CMD"] }' > "$script"
+    : > "$out"
+    report "$label" "$N" "$(elapsed "$ESH" "$script")"
+}
+
+run "echo >> file, built in" echo line ">>" "$out"
+run "echo >> file, /bin/echo" /bin/echo line ">>" "$out"
+run "printf >> file, built in" printf "%s-%d\\n" line 42 ">>" "$out"
+run "printf >> file, /usr/bin/printf" /usr/bin/printf "%s-%d\\n" line 42 ">>" "$out"
+run "true, built in" true
+run "true, /bin/true" /bin/true
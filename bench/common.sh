@@ -0,0 +1,24 @@
+# Helpers shared by the benchmark scripts, which source this file.
+
+ESH=${ESH:-./esh}
+
+# The current time in nanoseconds
+now() {
+    date +%s%N
+}
+
+# Print what was measured: a label, a count of operations and the
+# nanoseconds they took, as a rate and as the time per operation
+report() {
+    awk -v label="$1" -v n="$2" -v ns="$3" 'BEGIN {
+        printf "%-40s %8d in %8.3fs %12.0f/s %10.1fus each\n",
+               label, n, ns / 1e9, n / (ns / 1e9), ns / 1e3 / n
+    }'
+}
+
+# Run "$@" and print the nanoseconds it took
+elapsed() {
+    start=$(now)
+    "$@" >/dev/null 2>&1
+    echo $(($(now) - start))
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Launch latency of each engine, with esh at its usual size and grown
+# by $ESH_BLOAT_MB (default 512) megabytes with the bloat.so plug-in.
+#
+# esh runs a script of N lines of 'time /bin/true'.  The first figure
+# is the rate of the whole script: launch, run and reap, one line at a
+# time.  The second is the median fork-exec latency that 'time'
+# reports, from starting to launch the command until it exec'd.
+#
+. "$(dirname "$0")/common.sh"
+
+N=${N:-1000}
+script=$(mktemp)
+times=$(mktemp)
+trap 'rm -f "$script" "$times"' EXIT
+awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) print "time /bin/true" }' > "$script"
+
+for size in small large; do
+    plugins=
+    [ $size = large ] && plugins="-p bench"
+    for engine in spawn fork server; do
+        start=$(now)
+        "$ESH" $plugins -e $engine "$script" 2> "$times" >/dev/null
+        ns=$(($(now) - start))
+        median=$(awk '$1 ~ /ms$/ && $2 ~ /ms$/ { sub(/ms/, "", $1); print $1 }' "$times" \
+                 | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }')
+        report "$engine, $size shell" "$N" "$ns"
+        echo "    fork-exec median ${median}ms"
+    done
+done
@@ -0,0 +1,102 @@
+/*
+ * Allocations and time per parsed command line.
+ *
+ * Built by 'make bench' with the parser and libesh.a, linked with
+ * --wrap for malloc, calloc and realloc, so that every allocation the
+ * parser and the command line's arena make is counted here.  For each
+ * line it prints the allocations one parse makes, including freeing
+ * the line, those of copying its first pipeline out as a job, and the
+ * time a parse takes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../esh.h"
+#include "../esh-builtins.h"
+
+#define ITERATIONS 100000
+
+static const char *lines[] = {
+    "ls",
+    "ls -l /tmp",
+    "cat < in | sort -k2 | uniq -c > out",
+    "make -j8 all 2>&1 | tee build.log",
+    "a & b & c & d & e &",
+    "producer |+ (gzip > a.gz) (wc -l) (sha1sum)",
+    "time find . -name '*.c' -newer Makefile | xargs grep -l TODO >> todo",
+};
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *p, size_t size);
+
+static long allocations;
+
+void *
+__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+/* The parser does not use built-ins, but libesh.a's plug-in loader does */
+bool
+esh_builtin_register(const char *name, bool (* run)(struct esh_command *))
+{
+    return false;
+}
+
+static double
+now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int
+main(void)
+{
+    printf("%8s %8s %10s  %s\n", "allocs", "copy-out", "ns/parse", "line");
+    for (size_t i = 0; i < sizeof lines / sizeof *lines; i++) {
+        char *line = (char *) lines[i];
+
+        allocations = 0;
+        double start = now();
+        for (int k = 0; k < ITERATIONS; k++)
+            esh_command_line_free(esh_parse_command_line(line));
+        double elapsed = now() - start;
+        long parse = allocations;
+
+        struct esh_command_line *cline = esh_parse_command_line(line);
+        allocations = 0;
+        struct esh_pipeline *job = esh_pipeline_copy_out(
+            list_entry(list_front(&cline->pipes), struct esh_pipeline, elem));
+        long copy = allocations;
+        esh_pipeline_free(job);
+        esh_command_line_free(cline);
+
+        printf("%8.1f %8ld %10.0f  %s\n", (double) parse / ITERATIONS, copy,
+               elapsed / ITERATIONS * 1e9, line);
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The built-in command registry.
+ *
+ * Registered built-ins are kept in an open-addressed hash table
+ * that is at most half full, so a lookup probes one or two slots.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "esh-sys-utils.h"
+#include "esh-builtins.h"
+
+static struct esh_builtin *table;
+static size_t table_mask;       /* table size - 1; size is a power of 2 */
+static size_t table_count;
+
+/* FNV-1a */
+static size_t
+name_hash(const char *name)
+{
+    unsigned h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    return h;
+}
+
+/* Return the slot holding name, or the empty slot where it belongs */
+static struct esh_builtin *
+find_slot(struct esh_builtin *t, size_t mask, const char *name)
+{
+    size_t i = name_hash(name) & mask;
+    while (t[i].name && strcmp(t[i].name, name))
+        i = (i + 1) & mask;
+    return &t[i];
+}
+
+/* Double the table and rehash all entries. */
+static void
+grow_table(void)
+{
+    size_t oldsize = table ? table_mask + 1 : 0;
+    size_t newsize = oldsize ? 2 * oldsize : 16;
+    struct esh_builtin *t = calloc(newsize, sizeof *t);
+    if (t == NULL)
+        esh_sys_fatal_error("calloc: ");
+
+    for (size_t i = 0; i < oldsize; i++)
+        if (table[i].name)
+            *find_slot(t, newsize - 1, table[i].name) = table[i];
+
+    free(table);
+    table = t;
+    table_mask = newsize - 1;
+}
+
+/* Return the built-in named name, or NULL. */
+const struct esh_builtin *
+esh_builtin_lookup(const char *name)
+{
+    const struct esh_builtin *b = esh_builtin_core_lookup(name, strlen(name));
+    if (b != NULL || table == NULL)
+        return b;
+
+    b = find_slot(table, table_mask, name);
+    return b->name ? b : NULL;
+}
+
+/* Register a built-in.  Returns false if the name is already taken. */
+bool
+esh_builtin_register(const char *name, bool (* run)(struct esh_command *))
+{
+    if (esh_builtin_lookup(name) != NULL)
+        return false;
+
+    if (table == NULL || 2 * (table_count + 1) > table_mask + 1)
+        grow_table();
+
+    struct esh_builtin *slot = find_slot(table, table_mask, name);
+    slot->name = name;
+    slot->run = run;
+    table_count++;
+    return true;
+}
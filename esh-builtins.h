@@ -0,0 +1,57 @@
+#ifndef __ESH_BUILTINS_H
+#define __ESH_BUILTINS_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The built-in command registry.
+ *
+ * Core built-ins are looked up in a perfect hash generated by gperf
+ * from esh-builtins.gperf.  Built-ins registered at run time, which
+ * come from plugins, are kept in a hash table.  Core built-ins take
+ * precedence.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct esh_command;
+
+/* A built-in command.  run() executes it in the shell process and
+ * returns true if it handled the command; if it returns false, the
+ * command is run as an external program instead. */
+struct esh_builtin {
+    const char *name;
+    bool (* run)(struct esh_command *cmd);
+};
+
+/* Return the built-in named name, or NULL. */
+const struct esh_builtin * esh_builtin_lookup(const char *name);
+
+/* Register a built-in.  Returns false if the name is already taken. */
+bool esh_builtin_register(const char *name, bool (* run)(struct esh_command *));
+
+/* Generated from esh-builtins.gperf.  Requires gperf 3.1 or later. */
+const struct esh_builtin * esh_builtin_core_lookup(const char *str, size_t len);
+
+/* The core built-ins, implemented in esh.c */
+bool builtin_jobs(struct esh_command *cmd);
+bool builtin_fg(struct esh_command *cmd);
+bool builtin_bg(struct esh_command *cmd);
+bool builtin_kill(struct esh_command *cmd);
+bool builtin_stop(struct esh_command *cmd);
+bool builtin_hash(struct esh_command *cmd);
+bool builtin_jobstats(struct esh_command *cmd);
+bool builtin_parallel(struct esh_command *cmd);
+bool builtin_sched(struct esh_command *cmd);
+bool builtin_cgroup(struct esh_command *cmd);
+
+/* Fork-free echo, printf, test/[, true and false, implemented in
+ * esh-inproc.c.  They decline commands that are part of a longer
+ * pipeline, which then run as processes. */
+bool builtin_echo(struct esh_command *cmd);
+bool builtin_printf(struct esh_command *cmd);
+bool builtin_test(struct esh_command *cmd);
+bool builtin_true(struct esh_command *cmd);
+bool builtin_false(struct esh_command *cmd);
+
+#endif //__ESH_BUILTINS_H
@@ -0,0 +1,289 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Per-job cgroup v2 placement.
+ *
+ * The cgroups form this tree:
+ *
+ *      dir                 delegated to the user, given with -g
+ *      dir/esh-<pid>       the shell's, holds no processes itself
+ *      dir/esh-<pid>/jobN  one per job, removed once the job is done
+ *
+ * cgroup v2 only lets a cgroup without processes of its own hand its
+ * controllers down, so dir and esh-<pid> hold none and the leaves get
+ * cpu.weight, io.weight and memory.max.  Controllers that cannot be
+ * enabled are left out; the leaves then still account for CPU time,
+ * which cpu.stat always reports.
+ *
+ * A job's leaf is kept open, and esh_launch clones the commands into
+ * it, so the placement is part of the clone and needs no write to
+ * cgroup.procs afterwards.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "esh-sys-utils.h"
+#include "esh-cgroup.h"
+
+/* cpu.weight and io.weight of a foreground job, the kernel's default */
+#define FOREGROUND_WEIGHT 100
+
+struct esh_cgroup_limits esh_cgroup_limits = {
+    .cpu_weight = 50,
+    .io_weight = 50,
+    .memory_max = 0,
+};
+
+static int parent_fd = -1;          /* the delegated directory */
+static int shell_fd = -1;           /* esh-<pid> */
+static char shell_name[32];
+static int next_id = 1;
+
+/* Write value to the file name in cgroup dirfd.  Returns false on error. */
+static bool
+write_file(int dirfd, const char *name, const char *value)
+{
+    int fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n == (ssize_t) strlen(value);
+}
+
+/* Read the file name in cgroup dirfd into buf.  Returns false on error. */
+static bool
+read_file(int dirfd, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n == -1)
+        return false;
+    buf[n] = '\0';
+    return true;
+}
+
+/* Return the value of 'key' in a flat keyed file like cpu.stat, or -1. */
+static long long
+keyed_value(const char *buf, const char *key)
+{
+    size_t len = strlen(key);
+    for (const char *line = buf; line != NULL; line = strchr(line, '\n')) {
+        if (*line == '\n')
+            line++;
+        if (strncmp(line, key, len) == 0 && line[len] == ' ')
+            return atoll(line + len + 1);
+    }
+    return -1;
+}
+
+/* Let the children of cgroup dirfd use the controllers esh sets limits
+ * with, as far as dirfd has them. */
+static void
+enable_controllers(int dirfd)
+{
+    write_file(dirfd, "cgroup.subtree_control", "+cpu");
+    write_file(dirfd, "cgroup.subtree_control", "+io");
+    write_file(dirfd, "cgroup.subtree_control", "+memory");
+}
+
+/* Remove the shell's cgroup at exit.  Leaves of background jobs that
+ * are still running cannot be removed, and keep it around. */
+static void
+remove_shell_cgroup(void)
+{
+    char name[32];
+    for (int id = 1; id < next_id; id++) {
+        snprintf(name, sizeof name, "job%d", id);
+        unlinkat(shell_fd, name, AT_REMOVEDIR);
+    }
+    close(shell_fd);
+    unlinkat(parent_fd, shell_name, AT_REMOVEDIR);
+}
+
+bool
+esh_cgroup_init(const char *parent)
+{
+    struct statfs fs;
+
+    parent_fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd == -1) {
+        esh_sys_error("%s: ", parent);
+        return false;
+    }
+    if (fstatfs(parent_fd, &fs) == -1 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        fprintf(stderr, "esh: %s is not a cgroup v2 directory\n", parent);
+        goto fail;
+    }
+
+    snprintf(shell_name, sizeof shell_name, "esh-%d", (int) getpid());
+    if (mkdirat(parent_fd, shell_name, 0755) == -1 && errno != EEXIST) {
+        esh_sys_error("%s/%s: ", parent, shell_name);
+        goto fail;
+    }
+    shell_fd = openat(parent_fd, shell_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (shell_fd == -1) {
+        esh_sys_error("%s/%s: ", parent, shell_name);
+        unlinkat(parent_fd, shell_name, AT_REMOVEDIR);
+        goto fail;
+    }
+
+    enable_controllers(parent_fd);
+    enable_controllers(shell_fd);
+    atexit(remove_shell_cgroup);
+    return true;
+
+fail:
+    close(parent_fd);
+    parent_fd = -1;
+    return false;
+}
+
+bool
+esh_cgroup_enabled(void)
+{
+    return shell_fd != -1;
+}
+
+int
+esh_cgroup_create(bool background, int *id)
+{
+    char name[32];
+
+    snprintf(name, sizeof name, "job%d", next_id);
+    if (mkdirat(shell_fd, name, 0755) == -1) {
+        esh_sys_error("cgroup %s: ", name);
+        return -1;
+    }
+    int fd = openat(shell_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        esh_sys_error("cgroup %s: ", name);
+        unlinkat(shell_fd, name, AT_REMOVEDIR);
+        return -1;
+    }
+
+    if (esh_cgroup_limits.memory_max > 0) {
+        char value[32];
+        snprintf(value, sizeof value, "%lld", esh_cgroup_limits.memory_max);
+        write_file(fd, "memory.max", value);
+    }
+    /* a new cgroup already has the foreground weights */
+    if (background)
+        esh_cgroup_set_background(fd, true);
+
+    *id = next_id++;
+    return fd;
+}
+
+void
+esh_cgroup_set_background(int fd, bool background)
+{
+    char value[16];
+
+    if (fd == -1)
+        return;
+    snprintf(value, sizeof value, "%d",
+             background ? esh_cgroup_limits.cpu_weight : FOREGROUND_WEIGHT);
+    write_file(fd, "cpu.weight", value);
+    snprintf(value, sizeof value, "%d",
+             background ? esh_cgroup_limits.io_weight : FOREGROUND_WEIGHT);
+    write_file(fd, "io.weight", value);
+}
+
+void
+esh_cgroup_remove(int id, int fd)
+{
+    char name[32];
+
+    close(fd);
+    snprintf(name, sizeof name, "job%d", id);
+    /* fails with EBUSY if the job left processes behind */
+    unlinkat(shell_fd, name, AT_REMOVEDIR);
+}
+
+void
+esh_cgroup_print(FILE *out, int id, int fd)
+{
+    char buf[1024];
+    long long usage = -1, user = -1, system = -1;
+    long long current = -1, peak = -1;
+
+    if (fd == -1)
+        return;
+    if (read_file(fd, "cpu.stat", buf, sizeof buf)) {
+        usage = keyed_value(buf, "usage_usec");
+        user = keyed_value(buf, "user_usec");
+        system = keyed_value(buf, "system_usec");
+    }
+    if (read_file(fd, "memory.current", buf, sizeof buf))
+        current = atoll(buf);
+    if (read_file(fd, "memory.peak", buf, sizeof buf))
+        peak = atoll(buf);
+
+    fprintf(out, "    %s/job%d: cpu %.3fs (user %.3fs, system %.3fs)",
+            shell_name, id, usage / 1e6, user / 1e6, system / 1e6);
+    if (current != -1)
+        fprintf(out, ", memory %.1fM", current / 1048576.0);
+    if (peak != -1)
+        fprintf(out, " (peak %.1fM)", peak / 1048576.0);
+    fprintf(out, "\n");
+}
+
+bool
+esh_cgroup_set(const char *name, const char *value)
+{
+    struct esh_cgroup_limits *l = &esh_cgroup_limits;
+    char *end;
+    double v = strtod(value, &end);
+
+    if (end == value || v < 0)
+        return false;
+
+    if (!strcmp(name, "memory")) {
+        /* in bytes, or with a k, M or G suffix; 0 for no limit */
+        switch (*end) {
+        case 'G': case 'g': v *= 1024;      /* fall through */
+        case 'M': case 'm': v *= 1024;      /* fall through */
+        case 'k': case 'K': v *= 1024; break;
+        case '\0': break;
+        default: return false;
+        }
+        l->memory_max = v;
+        return true;
+    }
+
+    /* the kernel accepts weights from 1 to 10000 */
+    if (*end != '\0' || v < 1 || v > 10000)
+        return false;
+    if (!strcmp(name, "cpu"))
+        l->cpu_weight = v;
+    else if (!strcmp(name, "io"))
+        l->io_weight = v;
+    else
+        return false;
+    return true;
+}
+
+void
+esh_cgroup_print_limits(void)
+{
+    struct esh_cgroup_limits *l = &esh_cgroup_limits;
+
+    printf("cpu\t%d\t(cpu.weight of background jobs)\n", l->cpu_weight);
+    printf("io\t%d\t(io.weight of background jobs)\n", l->io_weight);
+    if (l->memory_max > 0)
+        printf("memory\t%lld\t(memory.max of every job)\n", l->memory_max);
+    else
+        printf("memory\tmax\t(memory.max of every job)\n");
+}
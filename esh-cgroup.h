@@ -0,0 +1,57 @@
+#ifndef __ESH_CGROUP_H
+#define __ESH_CGROUP_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Per-job cgroup v2 placement.
+ *
+ * With 'esh -g dir', where dir is a cgroup v2 directory delegated to
+ * the user, esh creates dir/esh-<pid> and starts every job in a leaf
+ * cgroup of its own below it.  The commands are cloned directly into
+ * the leaf (clone3 with CLONE_INTO_CGROUP), so whatever they start is
+ * accounted to the job as well.  Background jobs get a lower CPU and
+ * IO weight than the foreground job, and every job may be given a
+ * memory limit.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+struct esh_cgroup_limits {
+    int cpu_weight;             /* cpu.weight of background jobs */
+    int io_weight;              /* io.weight of background jobs */
+    long long memory_max;       /* memory.max of every job in bytes, 0 for none */
+};
+
+extern struct esh_cgroup_limits esh_cgroup_limits;
+
+/* Create the shell's cgroup below the delegated directory parent and
+ * enable the controllers it needs there.  Returns false if jobs
+ * cannot be placed in cgroups. */
+bool esh_cgroup_init(const char *parent);
+
+/* Return true if esh_cgroup_init() succeeded. */
+bool esh_cgroup_enabled(void);
+
+/* Create a leaf cgroup for a job, with the limits of a background or
+ * foreground job.  Returns a descriptor of its directory, for
+ * esh_launch, and sets *id to its number, or returns -1. */
+int esh_cgroup_create(bool background, int *id);
+
+/* Give a job's cgroup the weights of a background or foreground job. */
+void esh_cgroup_set_background(int fd, bool background);
+
+/* Close a job's cgroup and remove it, unless processes are left in it. */
+void esh_cgroup_remove(int id, int fd);
+
+/* Print the CPU time and memory used by a job's cgroup to out. */
+void esh_cgroup_print(FILE *out, int id, int fd);
+
+/* Set the limit called name ("cpu", "io" or "memory") from value.
+ * Returns false if either is invalid. */
+bool esh_cgroup_set(const char *name, const char *value);
+
+/* Print the limits to stdout. */
+void esh_cgroup_print_limits(void);
+
+#endif //__ESH_CGROUP_H
@@ -0,0 +1,475 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The fork server launch engine.
+ *
+ * The cost of fork() grows with the size of the calling process,
+ * and an interactive shell only grows: plugins, readline history and
+ * the job table all add to it.  With 'esh -e server', the shell forks
+ * a small helper at startup, before any of that is loaded, and sends
+ * it a request over a socketpair for each command to start.  argv,
+ * the process group and descriptor actions travel in the message,
+ * and so does the environment whenever it differs from what the
+ * helper has; the descriptors the command needs (the working
+ * directory, pipe ends, the terminal) are passed along with
+ * SCM_RIGHTS.  The helper moves to the shell's working directory
+ * before it starts the command.
+ *
+ * The helper starts each command with clone(CLONE_PARENT), which
+ * makes the command a child of the shell rather than of the helper.
+ * The shell therefore reaps and controls it exactly as if it had
+ * forked it itself, while the fork cost stays that of the helper.
+ * A command that is to run in a cgroup of its own is started with
+ * clone3(CLONE_PARENT | CLONE_INTO_CGROUP) instead.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "esh-sys-utils.h"
+#include "esh-launch.h"
+#include "esh-trace.h"
+
+/* Largest request, including argv strings and paths. */
+#define REQUEST_MAX 65536
+
+/* The fixed part of a request.  It is followed by envc environment
+ * strings if has_env is set, argc NUL-terminated argv strings, the file
+ * to exec if has_path is set, and then by the path of each ESH_FD_OPEN
+ * action. */
+struct request {
+    pid_t pgrp;
+    bool foreground;
+    bool has_env;
+    bool has_path;
+    bool has_cgroup;
+    int envc;
+    int argc;
+    int nactions;
+    struct {
+        enum esh_fd_op op;
+        int fd;
+        int srcfd;              /* ESH_FD_COPY only */
+        int flags;
+        mode_t mode;
+    } actions[ESH_LAUNCH_MAX_ACTIONS];
+};
+
+/* The reply: the new command's pid, or -1 and an errno value. */
+struct reply {
+    pid_t pid;
+    int error;
+};
+
+/* Descriptors passed with a request: the shell's working directory,
+ * the terminal if foreground, then the source of each ESH_FD_DUP
+ * action, then the cgroup if has_cgroup is set, then the exec_fd if
+ * any.  The server does not use the exec_fd; the command inherits it,
+ * and it is received close-on-exec like all others. */
+#define MAX_PASSED_FDS (ESH_LAUNCH_MAX_ACTIONS + 4)
+
+extern char **environ;
+
+static int server_sock = -1;        /* shell's end of the socketpair */
+
+/* The environment as last sent to the server, its strings one after
+ * the other, or NULL if the next request must send it. */
+static char *sent_env;
+static size_t sent_env_size;
+
+/* Append string s to buffer at *pos.  Returns false if it does not fit. */
+static bool
+put_string(char *buf, size_t *pos, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    if (*pos + len > REQUEST_MAX)
+        return false;
+    memcpy(buf + *pos, s, len);
+    *pos += len;
+    return true;
+}
+
+/* Return the string at *pos and advance past it, or NULL if the
+ * message is truncated. */
+static char *
+get_string(char *buf, size_t *pos, size_t len)
+{
+    char *s = buf + *pos;
+    char *end = memchr(s, '\0', len - *pos);
+    if (end == NULL)
+        return NULL;
+    *pos += end - s + 1;
+    return s;
+}
+
+/* Replace the server's environment by the n strings at *pos.
+ * Returns false if the message is truncated or memory runs out. */
+static bool
+set_environment(char *buf, size_t *pos, size_t len, int n)
+{
+    static char **owned;        /* the environment set last, if any */
+    char **env = calloc(n + 1, sizeof *env);
+    if (env == NULL)
+        return false;
+
+    for (int i = 0; i < n; i++) {
+        char *s = get_string(buf, pos, len);
+        if (s == NULL || (env[i] = strdup(s)) == NULL) {
+            for (int j = 0; j < i; j++)
+                free(env[j]);
+            free(env);
+            errno = s == NULL ? EINVAL : ENOMEM;
+            return false;
+        }
+    }
+
+    if (owned != NULL) {
+        for (char **e = owned; *e; e++)
+            free(*e);
+        free(owned);
+    }
+    environ = owned = env;
+    return true;
+}
+
+/* Start the command described by the request in buf, which came with
+ * descriptors fds.  Returns the child's pid, or -1 with errno set. */
+static pid_t
+serve_request(char *buf, size_t len, int *fds, int nfds)
+{
+    struct request *req = (struct request *) buf;
+    size_t pos = sizeof *req;
+    struct esh_launch l;
+    int ttyfd = -1;
+    int nextfd = 0;
+
+    if (req->argc < 1 || req->argc > REQUEST_MAX / 2
+            || req->envc < 0 || req->envc > REQUEST_MAX / 2
+            || req->nactions < 0 || req->nactions > ESH_LAUNCH_MAX_ACTIONS
+            || nfds < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Commands start in the shell's working directory, with its
+     * environment.  Both stay for the requests that follow. */
+    if (fchdir(fds[nextfd++]) == -1)
+        return -1;
+    if (req->has_env && !set_environment(buf, &pos, len, req->envc))
+        return -1;
+
+    char *argv[req->argc + 1];
+
+    for (int i = 0; i < req->argc; i++) {
+        if ((argv[i] = get_string(buf, &pos, len)) == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    argv[req->argc] = NULL;
+
+    esh_launch_init(&l, argv, req->pgrp, req->foreground);
+    if (req->has_path && (l.path = get_string(buf, &pos, len)) == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (req->foreground && nextfd < nfds)
+        ttyfd = fds[nextfd++];
+
+    for (int i = 0; i < req->nactions; i++) {
+        switch (req->actions[i].op) {
+        case ESH_FD_DUP:
+            if (nextfd == nfds) {
+                errno = EINVAL;
+                return -1;
+            }
+            esh_launch_dup(&l, fds[nextfd++], req->actions[i].fd);
+            break;
+
+        case ESH_FD_COPY:
+            esh_launch_copy(&l, req->actions[i].srcfd, req->actions[i].fd);
+            break;
+
+        case ESH_FD_OPEN: {
+            char *path = get_string(buf, &pos, len);
+            if (path == NULL) {
+                errno = EINVAL;
+                return -1;
+            }
+            esh_launch_open(&l, req->actions[i].fd, path,
+                            req->actions[i].flags, req->actions[i].mode);
+            break;
+        }
+
+        case ESH_FD_CLOSE:
+            esh_launch_close(&l, req->actions[i].fd);
+            break;
+        }
+    }
+
+    if (req->has_cgroup) {
+        if (nextfd == nfds) {
+            errno = EINVAL;
+            return -1;
+        }
+        l.cgroup_fd = fds[nextfd++];
+    }
+
+    /* Make the command a sibling of this server, i.e., a child of
+     * the shell.  Without CLONE_VM this behaves like fork(). */
+    pid_t child = esh_launch_clone(CLONE_PARENT, l.cgroup_fd);
+    if (child == 0) {
+        /* The server ignores job control signals; the command must not. */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        esh_launch_child(&l, ttyfd);
+    }
+    return child;
+}
+
+/* Main loop of the fork server.  Exits when the shell closes its end. */
+static void __attribute__((__noreturn__))
+server_loop(int sock)
+{
+    static char buf[REQUEST_MAX];
+
+    /* The server shares the shell's process group; keep it alive
+     * when the user types ^C or ^Z at the prompt. */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    for (;;) {
+        union {
+            char buf[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = { .iov_base = buf, .iov_len = sizeof buf };
+        struct msghdr msg = {
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = control.buf, .msg_controllen = sizeof control.buf
+        };
+
+        ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (len == 0)
+            _exit(EXIT_SUCCESS);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            _exit(EXIT_FAILURE);
+        }
+
+        int fds[MAX_PASSED_FDS];
+        int nfds = 0;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+                 && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+
+        struct reply reply = { .pid = -1, .error = EINVAL };
+        if ((size_t) len >= sizeof(struct request)) {
+            reply.pid = serve_request(buf, len, fds, nfds);
+            reply.error = reply.pid == -1 ? errno : 0;
+        }
+
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+
+        if (send(sock, &reply, sizeof reply, MSG_NOSIGNAL) == -1)
+            _exit(EXIT_FAILURE);
+    }
+}
+
+/* Start the fork server. */
+bool
+esh_forkserver_start(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        esh_sys_error("socketpair: ");
+        return false;
+    }
+
+    pid_t server = fork();
+    if (server == -1) {
+        esh_sys_error("fork: ");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (server == 0) {
+        close(sv[0]);
+        server_loop(sv[1]);
+    }
+
+    close(sv[1]);
+    server_sock = sv[0];
+    return true;
+}
+
+/* Return true if environ differs from the environment the server has. */
+static bool
+environment_changed(void)
+{
+    size_t pos = 0;
+
+    if (sent_env == NULL)
+        return true;
+    for (char **e = environ; *e; e++) {
+        size_t len = strlen(*e) + 1;
+        if (pos + len > sent_env_size || memcmp(sent_env + pos, *e, len))
+            return true;
+        pos += len;
+    }
+    return pos != sent_env_size;
+}
+
+/* Send the launch request to the server, with the working directory
+ * cwd.  Returns false if the request could not be encoded or sent. */
+static bool
+send_request(struct esh_launch *l, int cwd)
+{
+    static char buf[REQUEST_MAX];
+    struct request *req = (struct request *) buf;
+    size_t pos = sizeof *req;
+    int fds[MAX_PASSED_FDS];
+    int nfds = 0;
+
+    fds[nfds++] = cwd;
+    req->has_env = environment_changed();
+    req->envc = 0;
+    if (req->has_env) {
+        for (; environ[req->envc]; req->envc++)
+            if (!put_string(buf, &pos, environ[req->envc]))
+                return false;
+    }
+    size_t env_size = pos - sizeof *req;
+
+    req->pgrp = l->pgrp;
+    req->foreground = l->foreground;
+    req->nactions = l->nactions;
+    for (req->argc = 0; l->argv[req->argc]; req->argc++)
+        if (!put_string(buf, &pos, l->argv[req->argc]))
+            return false;
+
+    req->has_path = l->path != NULL;
+    if (l->path && !put_string(buf, &pos, l->path))
+        return false;
+
+    if (l->foreground)
+        fds[nfds++] = esh_sys_tty_getfd();
+
+    for (int i = 0; i < l->nactions; i++) {
+        struct esh_fd_action *a = &l->actions[i];
+        req->actions[i].op = a->op;
+        req->actions[i].fd = a->fd;
+        req->actions[i].srcfd = a->srcfd;
+        req->actions[i].flags = a->flags;
+        req->actions[i].mode = a->mode;
+        if (a->op == ESH_FD_DUP)
+            fds[nfds++] = a->srcfd;
+        else if (a->op == ESH_FD_OPEN && !put_string(buf, &pos, a->path))
+            return false;
+    }
+    req->has_cgroup = l->cgroup_fd != -1;
+    if (l->cgroup_fd != -1)
+        fds[nfds++] = l->cgroup_fd;
+    if (l->exec_fd != -1)
+        fds[nfds++] = l->exec_fd;
+
+    union {
+        char buf[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = buf, .iov_len = pos };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (nfds > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    if (sendmsg(server_sock, &msg, MSG_NOSIGNAL) == -1)
+        return false;
+
+    if (req->has_env) {
+        free(sent_env);
+        sent_env = malloc(env_size);
+        if (sent_env != NULL)
+            memcpy(sent_env, buf + sizeof *req, env_size);
+        sent_env_size = env_size;
+    }
+    return true;
+}
+
+/* Start the command described by l through the fork server.
+ * Falls back to posix_spawn if the server is not available. */
+pid_t
+esh_forkserver_launch(struct esh_launch *l)
+{
+    struct reply reply;
+
+    if (server_sock == -1)
+        return esh_launch_spawn(l);
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1)
+        return esh_launch_spawn(l);
+    bool sent = send_request(l, cwd);
+    close(cwd);
+    if (!sent)
+        return esh_launch_spawn(l);
+
+    ssize_t n;
+    do {
+        n = recv(server_sock, &reply, sizeof reply, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n != sizeof reply) {
+        /* The server died.  Use posix_spawn from now on. */
+        esh_sys_error("fork server is gone, using spawn engine: ");
+        close(server_sock);
+        server_sock = -1;
+        esh_launch_engine = ESH_ENGINE_SPAWN;
+        return esh_launch_spawn(l);
+    }
+
+    if (reply.pid == -1) {
+        /* the server may not have taken the environment */
+        free(sent_env);
+        sent_env = NULL;
+        errno = reply.error;
+        return -1;
+    }
+
+    /* The command is our child.  As with fork, set its process group
+     * here too, so the next command of the pipeline can join it. */
+    uint64_t t = esh_trace_now();
+    if (setpgid(reply.pid, l->pgrp ? l->pgrp : reply.pid) == -1
+            && errno != EACCES && errno != ESRCH)
+        esh_sys_error("setpgid: ");
+    esh_trace_complete("setpgid", t, reply.pid, NULL);
+
+    return reply.pid;
+}
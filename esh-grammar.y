@@ -7,15 +7,28 @@
  * This is based on an assignment I did in 1993 as an undergraduate
  * student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * All nodes and words of a command line are allocated from the
+ * command line's arena, so that a parse error can release everything
+ * built so far by freeing the command line.
+ *
+ * Parser and scanner are reentrant: all parse state lives in the
+ * scanner object and the command line passed to yyparse(), so that
+ * lines can be parsed concurrently from several threads.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/resource.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
 
 /*
  * Error messages, csh-style
@@ -24,93 +37,268 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define TOOMANY "Too many redirects."
+#define MISTIME "'time' must start a pipeline."
+#define BADFD   "Bad file descriptor."
 
 #include "esh.h"
+#include "esh-sys-utils.h"
 
 #define obstack_chunk_alloc malloc
 #define obstack_chunk_free free
 
+void yyerror(yyscan_t scanner, struct esh_command_line *commandline,
+             const char *msg);
+
+/* A word of a command being collected */
+struct word_list {
+    char *word;
+    struct word_list *next;
+};
+
+/* A redirection of a command being collected */
+struct redirect_list {
+    enum esh_redirect_op op;
+    int fd;
+    int srcfd;
+    char *path;
+    struct redirect_list *next;
+};
+
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
-    char *iored_input;
-    char *iored_output;
-    bool append_to_output;
+    struct word_list *first;    /* words collected for argv, in order */
+    struct word_list *last;
+    int nwords;
+    struct redirect_list *first_redirect;   /* redirections, in order */
+    struct redirect_list *last_redirect;
+    int nredirects;
+    char *iored_input;          /* file stdin is redirected from, if any */
+    char *iored_output;         /* file stdout is redirected to, if any */
 };
 
+/* Append a word to cmd_helper */
+static void
+add_word(struct esh_command_line *cline, struct cmd_helper *cmd, char *word)
+{
+    struct word_list *w = obstack_alloc(&cline->arena, sizeof *w);
+    w->word = word;
+    w->next = NULL;
+    if (cmd->last)
+        cmd->last->next = w;
+    else
+        cmd->first = w;
+    cmd->last = w;
+    cmd->nwords++;
+}
+
 /* Initialize cmd_helper and, optionally, set first argv */
 static void
-init_cmd(struct cmd_helper *cmd, char *firstcmd, 
-         char *iored_input, char *iored_output, bool append_to_output)
+init_cmd(struct esh_command_line *cline, struct cmd_helper *cmd,
+         char *firstcmd)
 {
-    obstack_init(&cmd->words);
+    cmd->first = cmd->last = NULL;
+    cmd->nwords = 0;
+    cmd->first_redirect = cmd->last_redirect = NULL;
+    cmd->nredirects = 0;
+    cmd->iored_input = cmd->iored_output = NULL;
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        add_word(cline, cmd, firstcmd);
+}
+
+/* Append a redirection to cmd_helper */
+static void
+add_redirect(struct esh_command_line *cline, struct cmd_helper *cmd,
+             enum esh_redirect_op op, int fd, int srcfd, char *path)
+{
+    struct redirect_list *r = obstack_alloc(&cline->arena, sizeof *r);
+    r->op = op;
+    r->fd = fd;
+    r->srcfd = srcfd;
+    r->path = path;
+    r->next = NULL;
+    if (cmd->last_redirect)
+        cmd->last_redirect->next = r;
+    else
+        cmd->first_redirect = r;
+    cmd->last_redirect = r;
+    cmd->nredirects++;
+
+    if (op == ESH_REDIRECT_INPUT && fd == 0)
+        cmd->iored_input = path;
+    if ((op == ESH_REDIRECT_OUTPUT || op == ESH_REDIRECT_APPEND) && fd == 1)
+        cmd->iored_output = path;
+}
+
+/* Initialize cmd_helper with a single redirection and no words */
+static void
+init_redirect(struct esh_command_line *cline, struct cmd_helper *cmd,
+              enum esh_redirect_op op, int fd, char *path)
+{
+    init_cmd(cline, cmd, NULL);
+    add_redirect(cline, cmd, op, fd, -1, path);
+}
 
-    cmd->iored_output = iored_output;
-    cmd->iored_input = iored_input;
-    cmd->append_to_output = append_to_output;
+/* Initialize cmd_helper with 'fd>&word' or 'fd<&word', where word is
+ * a descriptor, or '-' to close fd.  Returns false if it is neither. */
+static bool
+init_dup(struct esh_command_line *cline, struct cmd_helper *cmd,
+         int fd, char *word)
+{
+    init_cmd(cline, cmd, NULL);
+    if (!strcmp(word, "-")) {
+        add_redirect(cline, cmd, ESH_REDIRECT_CLOSE, fd, -1, NULL);
+        return true;
+    }
+
+    char *end;
+    long srcfd = strtol(word, &end, 10);
+    if (*word < '0' || *word > '9' || *end != '\0' || srcfd > INT_MAX)
+        return false;
+    add_redirect(cline, cmd, ESH_REDIRECT_DUP, fd, srcfd, NULL);
+    return true;
+}
+
+/* Return true if fd may be redirected: no descriptor at or above the
+ * soft limit on open files can exist.  The scanner clamps larger
+ * numbers to INT_MAX, which this rejects as well. */
+static bool
+valid_io_number(int fd)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur > INT_MAX)
+        rl.rlim_cur = INT_MAX;
+    return fd < (int) rl.rlim_cur;
+}
+
+/* Move the redirections of from to the end of those of to */
+static void
+append_redirects(struct cmd_helper *to, struct cmd_helper *from)
+{
+    if (from->first_redirect == NULL)
+        return;
+    if (to->last_redirect)
+        to->last_redirect->next = from->first_redirect;
+    else
+        to->first_redirect = from->first_redirect;
+    to->last_redirect = from->last_redirect;
+    to->nredirects += from->nredirects;
+    if (from->iored_input)
+        to->iored_input = from->iored_input;
+    if (from->iored_output)
+        to->iored_output = from->iored_output;
 }
 
 /* print error message */
 static void p_error(char *msg);
 
+/* Append the relay that feeds the consumers of a '|+' fan-out */
+static void
+add_relay(struct esh_command_line *cline, struct esh_pipeline *pipe)
+{
+    char **argv = obstack_alloc(&cline->arena, 2 * sizeof *argv);
+    argv[0] = obstack_copy0(&cline->arena, "|+", 2);
+    argv[1] = NULL;
+
+    struct esh_command *relay = esh_command_create(cline, argv,
+                                                   NULL, NULL, false);
+    relay->relay = true;
+    relay->pipeline = pipe;
+    list_push_back(&pipe->commands, &relay->elem);
+}
+
+/* Return true if the first command of pipe reads from a file */
+static bool
+reads_file(struct esh_pipeline *pipe)
+{
+    struct esh_command *first = list_entry(list_front(&pipe->commands),
+                                           struct esh_command, elem);
+    return first->iored_input != NULL;
+}
+
+/* Move the commands of branch to the end of pipe, as the commands of
+ * its next consumer.  The commands of all consumers are in the one
+ * pipeline, which makes them one job. */
+static void
+add_branch(struct esh_pipeline *pipe, struct esh_pipeline *branch)
+{
+    pipe->branches++;
+    while (!list_empty(&branch->commands)) {
+        struct esh_command *cmd = list_entry(list_pop_front(&branch->commands),
+                                             struct esh_command, elem);
+        cmd->branch = pipe->branches;
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+}
+
 /* Convert cmd_helper to esh_command.
  * Ensures NULL-terminated argv[] array
  */
 static struct esh_command * 
-make_esh_command(struct cmd_helper *cmd)
+make_esh_command(struct esh_command_line *cline, struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
-
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
-
-    if (*argv == NULL) {
-        free(argv);
+    if (cmd->nwords == 0)
         return NULL; 
-    }
 
-    return esh_command_create(argv,
-                              cmd->iored_input,
-                              cmd->iored_output,
-                              cmd->append_to_output);
+    char **argv = obstack_alloc(&cline->arena,
+                                (cmd->nwords + 1) * sizeof *argv);
+    int i = 0;
+    for (struct word_list *w = cmd->first; w; w = w->next)
+        argv[i++] = w->word;
+    argv[i] = NULL;
+
+    struct esh_command *pcmd = esh_command_create(cline, argv,
+                                                  NULL, NULL, false);
+    for (struct redirect_list *r = cmd->first_redirect; r; r = r->next)
+        esh_command_add_redirect(cline, pcmd, r->op, r->fd, r->srcfd, r->path);
+    return pcmd;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct esh_command_line *);
-
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
-
 %}
 
+%define api.pure full
+%lex-param   {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {struct esh_command_line *commandline}
+
 /* LALR stack types */
 %union {
   struct cmd_helper command;
   struct esh_pipeline * pipe;
   struct esh_command_line * cmdline;
   char *word;
+  int number;
 }
 
 /* Nonterminals */
-%type <command> input output
+%type <command> redirect
 %type <command> command
-%type <pipe> pipeline
+%type <number> io_number
+%type <pipe> pipeline fanout fanout_pipeline timed_pipeline
+%type <word> word
 %type <cmdline> cmd_list
 
 /* Terminals */
 %token <word> WORD
+%token <word> TIME      /* 'time', a keyword only before a pipeline */
+%token <number> IO_NUMBER /* the n in 'n<file', 'n>file' or 'n>&m' */
 %token GREATER_GREATER 
+%token GREATER_AMP      /* '>&' */
+%token LESS_AMP         /* '<&' */
+%token AMP_GREATER      /* '&>', which redirects stdout and stderr */
+%token PIPE_PLUS        /* '|+', which sends output to several consumers */
+
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+}
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list { assert($1 == commandline); }
 
-cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
-|		pipeline { 
+cmd_list:	/* Null Command */ { $$ = commandline; }
+|		timed_pipeline { 
             esh_pipeline_finish($1);
-            $$ = esh_command_line_create($1);
+            $$ = commandline;
+            list_push_back(&$$->pipes, &$1->elem);
         } 
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -120,12 +308,12 @@ cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
                               struct esh_pipeline, elem);
             last->bg_job = true;
         }
-|		cmd_list ';' pipeline	{ 
+|		cmd_list ';' timed_pipeline	{ 
             esh_pipeline_finish($3);
             $$ = $1;
             list_push_back(&$$->pipes, &$3->elem);
         }
-|		cmd_list '&' pipeline	{ 
+|		cmd_list '&' timed_pipeline	{ 
             esh_pipeline_finish($3);
             $$ = $1;
 
@@ -137,10 +325,17 @@ cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
             list_push_back(&$$->pipes, &$3->elem);
         }
 
+timed_pipeline: fanout_pipeline
+|		TIME fanout_pipeline {
+            $2->timed = true;
+            $$ = $2;
+        }
+|		TIME error { p_error(INVNUL); YYABORT; }
+
 pipeline: command {
-            struct esh_command * pcmd = make_esh_command(&$1);
+            struct esh_command * pcmd = make_esh_command(commandline, &$1);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
-            $$ = esh_pipeline_create(pcmd);
+            $$ = esh_pipeline_create(commandline, pcmd);
 		}
 |		pipeline '|' command {
 		    /* Error: 'ls >x | wc' */
@@ -152,7 +347,7 @@ pipeline: command {
 		    /* Error: 'ls | <x wc' */
 		    if ($3.iored_input) { p_error(AMBINP); YYABORT; }
 
-            struct esh_command * pcmd = make_esh_command(&$3);
+            struct esh_command * pcmd = make_esh_command(commandline, &$3);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
 
             list_push_back(&$1->commands, &pcmd->elem);
@@ -160,56 +355,109 @@ pipeline: command {
             $$ = $1;
 		}
 |		'|' error 	   { p_error(INVNUL); YYABORT; }
+		/* Error: 'ls | time wc' */
+|		pipeline '|' TIME  { p_error(MISTIME); YYABORT; }
 |		pipeline '|' error { p_error(INVNUL); YYABORT; }
 
+fanout_pipeline: pipeline
+|		fanout
+
+		/* 'cmd |+ (a) (b)': a and b each read all of cmd's output */
+fanout:	pipeline PIPE_PLUS '(' pipeline ')' {
+		    /* Error: 'ls >x |+ (wc)' */
+            struct esh_command * last;
+            last = list_entry(list_back(&$1->commands), 
+                              struct esh_command, elem);
+		    if (last->iored_output) { p_error(AMBOUT); YYABORT; }
+
+		    /* Error: 'ls |+ (<x wc)' */
+		    if (reads_file($4)) { p_error(AMBINP); YYABORT; }
+
+            add_relay(commandline, $1);
+            add_branch($1, $4);
+            $$ = $1;
+        }
+|		fanout '(' pipeline ')' {
+		    if (reads_file($3)) { p_error(AMBINP); YYABORT; }
+            add_branch($1, $3);
+            $$ = $1;
+        }
+		/* Error: 'ls |+ (time wc)' */
+|		pipeline PIPE_PLUS '(' TIME { p_error(MISTIME); YYABORT; }
+|		fanout '(' TIME    { p_error(MISTIME); YYABORT; }
+|		pipeline PIPE_PLUS error { p_error(INVNUL); YYABORT; }
+|		fanout '(' error   { p_error(INVNUL); YYABORT; }
+
 command:   WORD { 
-            init_cmd(&$$, $1, NULL, NULL, false);
+            init_cmd(commandline, &$$, $1);
         }
-|		input   
-|		output
-|		command WORD {
+|		redirect
+|		command word {
             $$ = $1;
-            obstack_ptr_grow(&$$.words, $2);
+            add_word(commandline, &$$, $2);
 		}
-|		command input {
-            obstack_free(&$2.words, NULL);
+|		command redirect {
             /* Error: ambiguous redirect 'a <b <c' */
-            if($1.iored_input)   { p_error(AMBINP); YYABORT; }
-            $$ = $1; 
-            $$.iored_input = $2.iored_input;
-		}
-|		command output {
-            obstack_free(&$2.words, NULL);
+            if ($1.iored_input && $2.iored_input)   { p_error(AMBINP); YYABORT; }
             /* Error: ambiguous redirect 'a >b >c' */
-            if ($1.iored_output) { p_error(AMBOUT); YYABORT; }
-            $$ = $1; 
-            $$.iored_output = $2.iored_output;
-            $$.append_to_output = $2.append_to_output;
+            if ($1.iored_output && $2.iored_output) { p_error(AMBOUT); YYABORT; }
+            if ($1.nredirects + $2.nredirects > ESH_MAX_REDIRECTS) {
+                p_error(TOOMANY); YYABORT;
+            }
+            $$ = $1;
+            append_redirects(&$$, &$2);
 		}
 
-input:	'<' WORD { 
-            init_cmd(&$$, NULL, $2, NULL, false);
+		/* The descriptor a redirect applies to, -1 for its default */
+io_number: /* none */ { $$ = -1; }
+|		IO_NUMBER {
+            if (!valid_io_number($1)) { p_error(BADFD); YYABORT; }
+            $$ = $1;
         }
-|		'<' error	  { p_error(MISRED); YYABORT; }
 
-output:	'>' WORD { 
-            init_cmd(&$$, NULL, NULL, $2, false);
+redirect: io_number '<' word { 
+            init_redirect(commandline, &$$, ESH_REDIRECT_INPUT,
+                          $1 == -1 ? 0 : $1, $3);
+        }
+|		io_number '>' word { 
+            init_redirect(commandline, &$$, ESH_REDIRECT_OUTPUT,
+                          $1 == -1 ? 1 : $1, $3);
+        }
+|		io_number GREATER_GREATER word { 
+            init_redirect(commandline, &$$, ESH_REDIRECT_APPEND,
+                          $1 == -1 ? 1 : $1, $3);
+        }
+|		io_number LESS_AMP word {
+            if (!init_dup(commandline, &$$, $1 == -1 ? 0 : $1, $3)) {
+                p_error(AMBINP); YYABORT;
+            }
         }
-|		GREATER_GREATER WORD { 
-            init_cmd(&$$, NULL, NULL, $2, true);
+|		io_number GREATER_AMP word {
+            if (!init_dup(commandline, &$$, $1 == -1 ? 1 : $1, $3)) {
+                /* Error: '2>&file' */
+                if ($1 != -1) { p_error(AMBOUT); YYABORT; }
+                /* '>&file' is '&>file' */
+                init_redirect(commandline, &$$, ESH_REDIRECT_OUTPUT, 1, $3);
+                add_redirect(commandline, &$$, ESH_REDIRECT_DUP, 2, 1, NULL);
+            }
+        }
+|		AMP_GREATER word {
+            init_redirect(commandline, &$$, ESH_REDIRECT_OUTPUT, 1, $2);
+            add_redirect(commandline, &$$, ESH_REDIRECT_DUP, 2, 1, NULL);
         }
 		/* Error: missing redirect */
-|		'>' error 	  { p_error(MISRED); YYABORT; }
-|		GREATER_GREATER error { p_error(MISRED); YYABORT; }
+|		io_number '<' error	  { p_error(MISRED); YYABORT; }
+|		io_number '>' error 	  { p_error(MISRED); YYABORT; }
+|		io_number GREATER_GREATER error { p_error(MISRED); YYABORT; }
+|		io_number LESS_AMP error { p_error(MISRED); YYABORT; }
+|		io_number GREATER_AMP error { p_error(MISRED); YYABORT; }
+|		AMP_GREATER error { p_error(MISRED); YYABORT; }
 
-%%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
+		/* 'time' is an ordinary word anywhere but before a pipeline */
+word:	WORD
+|		TIME
 
-#define YY_NO_INPUT
+%%
 #include "lex.yy.c"
 
 static void
@@ -219,28 +467,33 @@ p_error(char *msg)
     fprintf(stderr, "%s\n", msg); 
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
 void 
-yyerror(const char *msg) { }
-
-static struct esh_command_line * commandline;
-static void cmdline_complete(struct esh_command_line *cline)
-{
-    commandline = cline;
-}
+yyerror(yyscan_t scanner, struct esh_command_line *commandline,
+        const char *msg) { }
 
 /* 
  * parse a commandline.
+ * The scanner reads the line straight from memory rather than a
+ * byte at a time through YY_INPUT.
  */
 struct esh_command_line *
 esh_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
+    struct esh_command_line *commandline = esh_command_line_create_empty();
+    yyscan_t scanner;
 
-    int error = yyparse();
+    if (yylex_init_extra(commandline, &scanner))
+        esh_sys_fatal_error("yylex_init_extra: ");
 
-    return error ? NULL : commandline;
+    yy_scan_bytes(line, strlen(line), scanner);
+    int error = yyparse(scanner, commandline);
+    yylex_destroy(scanner);
+
+    if (error) {
+        /* releases everything allocated during the parse */
+        esh_command_line_free(commandline);
+        return NULL;
+    }
+    return commandline;
 }
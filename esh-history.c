@@ -0,0 +1,348 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Persistent command history.
+ *
+ * The log is a sequence of records
+ *
+ *      : <seconds since the epoch>:<length>;<line>\n
+ *
+ * Each record is appended with a single write to a descriptor opened
+ * with O_APPEND, which the kernel places at the end of the file as a
+ * whole, so several shells append to the same log without any locks
+ * and without their records interleaving.  The length makes a line
+ * that contains newlines, which a paste can produce, one record.
+ *
+ * The index holds where the line of each record starts and its length.
+ * It is built on the first search and extended by the records that
+ * were appended since, whenever a search starts.  A record that does
+ * not parse, such as one cut short by a crash, is skipped up to the
+ * next line that starts with ": ".
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "esh-sys-utils.h"
+#include "esh-history.h"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+struct record {
+    size_t offset;              /* of the line in the log */
+    size_t length;
+};
+
+static int log_fd = -1;
+
+static char *map;               /* the log, as far as it is mapped */
+static size_t mapped;
+static size_t indexed;          /* bytes of the mapping that are indexed */
+static struct record *records;  /* the index, oldest first */
+static size_t nrecords, maxrecords;
+
+/* The search in progress.  While it lasts, every key is bound to
+ * search_key, so readline's callback interface hands the keys over one
+ * at a time and the event loop keeps running in between. */
+static struct {
+    char s[256];                /* the search string */
+    size_t len;
+    ssize_t match;              /* record shown, or -1 */
+    char *saved;                /* the line before the search */
+    int saved_point;
+    Keymap keymap;              /* to return to when it ends */
+} search_state;
+static Keymap search_keymap;
+
+static int search(int count, int key);
+static int search_key(int count, int key);
+
+/* Put the log's path, $ESH_HISTFILE or ~/.esh_history.<hostname>,
+ * into path.  Returns false if there is to be no log. */
+static bool
+log_path(char *path, size_t size)
+{
+    char *env = getenv("ESH_HISTFILE");
+    if (env != NULL) {
+        snprintf(path, size, "%s", env);
+        return *env != '\0';
+    }
+
+    char *home = getenv("HOME");
+    char host[HOST_NAME_MAX + 1];
+    if (home == NULL || gethostname(host, sizeof host) == -1)
+        return false;
+    host[HOST_NAME_MAX] = '\0';
+    snprintf(path, size, "%s/.esh_history.%s", home, host);
+    return true;
+}
+
+bool
+esh_history_init(void)
+{
+    char path[PATH_MAX];
+
+    if (!log_path(path, sizeof path))
+        return false;
+    log_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (log_fd == -1) {
+        esh_sys_error("%s: ", path);
+        return false;
+    }
+    rl_add_defun("esh-history-search", search, CTRL_KEY('r'));
+    /* set the entries directly: rl_bind_key_in_map() would bind Escape
+     * and the 8-bit keys as meta sequences, which must end the search */
+    search_keymap = rl_make_bare_keymap();
+    for (int c = 0; c < KEYMAP_SIZE; c++) {
+        search_keymap[c].type = ISFUNC;
+        search_keymap[c].function = search_key;
+    }
+    return true;
+}
+
+void
+esh_history_add(const char *line)
+{
+    if (line[strspn(line, " \t")] == '\0')
+        return;
+    add_history(line);
+    if (log_fd == -1)
+        return;
+
+    char header[64];
+    size_t length = strlen(line);
+    struct iovec iov[] = {
+        { header, snprintf(header, sizeof header, ": %lld:%zu;",
+                           (long long) time(NULL), length) },
+        { (char *) line, length },
+        { "\n", 1 },
+    };
+    /* one write, which O_APPEND keeps in one piece */
+    if (writev(log_fd, iov, 3) == -1)
+        esh_sys_error("history: ");
+}
+
+/* Parse the number at *p, before end, and advance *p past it.
+ * Returns false if there is none. */
+static bool
+parse_number(const char **p, const char *end, size_t *n)
+{
+    const char *start = *p;
+    *n = 0;
+    while (*p < end && **p >= '0' && **p <= '9' && *n < SIZE_MAX / 10)
+        *n = *n * 10 + (*(*p)++ - '0');
+    return *p > start;
+}
+
+/* Parse the record at pos.  Returns the offset of the next one and
+ * fills in r, or returns 0 if there is no valid record at pos. */
+static size_t
+parse_record(size_t pos, struct record *r)
+{
+    const char *p = map + pos, *end = map + mapped;
+    size_t seconds, length;
+
+    if (end - p < 2 || p[0] != ':' || p[1] != ' ')
+        return 0;
+    p += 2;
+    if (!parse_number(&p, end, &seconds) || p == end || *p++ != ':')
+        return 0;
+    if (!parse_number(&p, end, &length) || p == end || *p++ != ';')
+        return 0;
+    if ((size_t) (end - p) <= length || p[length] != '\n')
+        return 0;
+
+    r->offset = p - map;
+    r->length = length;
+    return r->offset + length + 1;
+}
+
+/* Map what was appended to the log since the last call, and index it. */
+static void
+update_index(void)
+{
+    struct stat st;
+
+    if (fstat(log_fd, &st) == -1)
+        return;
+    /* a log that was cut down is indexed again; reading the mapping
+     * past its new end would fault */
+    if ((size_t) st.st_size < mapped) {
+        munmap(map, mapped);
+        map = NULL;
+        mapped = indexed = nrecords = 0;
+    }
+    if ((size_t) st.st_size == mapped)
+        return;
+
+    void *m = map == NULL
+            ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log_fd, 0)
+            : mremap(map, mapped, st.st_size, MREMAP_MAYMOVE);
+    if (m == MAP_FAILED) {
+        esh_sys_error("history: ");
+        return;
+    }
+    map = m;
+    mapped = st.st_size;
+
+    while (indexed < mapped) {
+        struct record r;
+        size_t next = parse_record(indexed, &r);
+        if (next == 0) {
+            /* skip to the next line that looks like a record */
+            char *nl = memmem(map + indexed + 1, mapped - indexed - 1, "\n: ", 3);
+            indexed = nl ? (size_t) (nl + 1 - map) : mapped;
+            continue;
+        }
+        if (nrecords == maxrecords) {
+            maxrecords = maxrecords ? 2 * maxrecords : 4096;
+            records = realloc(records, maxrecords * sizeof *records);
+            if (records == NULL)
+                esh_sys_fatal_error("history: ");
+        }
+        records[nrecords++] = r;
+        indexed = next;
+    }
+}
+
+/* Return true if record i is the same line as record j. */
+static bool
+same_line(size_t i, size_t j)
+{
+    return records[i].length == records[j].length
+        && !memcmp(map + records[i].offset, map + records[j].offset,
+                   records[i].length);
+}
+
+/* Return the newest record at or before 'from' that contains s, and
+ * is not the same line as 'skip', or -1. */
+static ssize_t
+find(ssize_t from, const char *s, ssize_t skip)
+{
+    size_t len = strlen(s);
+    for (ssize_t i = from; i >= 0; i--) {
+        struct record *r = &records[i];
+        if (memmem(map + r->offset, r->length, s, len) != NULL
+                && (skip == -1 || !same_line(i, skip)))
+            return i;
+    }
+    return -1;
+}
+
+/* Show record i, with the cursor at the first occurrence of s. */
+static void
+show(ssize_t i, const char *s)
+{
+    char *line = strndup(map + records[i].offset, records[i].length);
+    if (line == NULL)
+        return;
+    rl_replace_line(line, 0);
+    char *at = strstr(line, s);
+    rl_point = at ? at - line : 0;
+    free(line);
+}
+
+/* Show the search prompt. */
+static void
+prompt(void)
+{
+    rl_message("(%sreverse-i-search)`%s': ",
+               search_state.match == -1 && search_state.len > 0 ? "failed " : "",
+               search_state.s);
+    rl_redisplay();
+}
+
+/*
+ * Incremental reverse search, bound to Ctrl-R.
+ * Typing extends the search string, Ctrl-R finds the next older
+ * match, Backspace shortens the string, and Ctrl-G restores the line
+ * as it was.  Any other key ends the search with the match in the line
+ * buffer and is then handled as usual, so Enter runs the match and
+ * an arrow key moves in it.  The keys that follow Ctrl-R go to
+ * search_key.
+ */
+static int
+search(int count, int key)
+{
+    update_index();
+    search_state.s[0] = '\0';
+    search_state.len = 0;
+    search_state.match = -1;
+    search_state.saved = strdup(rl_line_buffer);
+    search_state.saved_point = rl_point;
+    search_state.keymap = rl_get_keymap();
+    rl_save_prompt();
+    rl_set_keymap(search_keymap);
+    prompt();
+    return 0;
+}
+
+/* End the search, with the line buffer as it is now. */
+static void
+end_search(void)
+{
+    rl_set_keymap(search_state.keymap);
+    rl_restore_prompt();
+    rl_clear_message();
+    free(search_state.saved);
+    search_state.saved = NULL;
+}
+
+/* Handle key c of a search. */
+static int
+search_key(int count, int c)
+{
+    char *s = search_state.s;
+    size_t *len = &search_state.len;
+    ssize_t *match = &search_state.match;
+
+    if (c == CTRL_KEY('r')) {
+        if (*match != -1 && *len > 0) {
+            ssize_t older = find(*match - 1, s, *match);
+            if (older == -1)
+                rl_ding();
+            else
+                *match = older;
+        } else if (*len > 0) {
+            rl_ding();
+        }
+    } else if (c == CTRL_KEY('g')) {
+        if (search_state.saved != NULL) {
+            rl_replace_line(search_state.saved, 0);
+            rl_point = search_state.saved_point;
+        }
+        end_search();
+        return 0;
+    } else if (c == 0x7f || c == CTRL_KEY('h')) {
+        if (*len > 0)
+            s[--*len] = '\0';
+        *match = *len > 0 ? find(nrecords - 1, s, -1) : -1;
+    } else if (c >= ' ' && *len < sizeof search_state.s - 1) {
+        s[(*len)++] = c;
+        s[*len] = '\0';
+        *match = find(*match == -1 ? (ssize_t) nrecords - 1 : *match, s, -1);
+    } else {
+        /* Escape starts the sequences of the arrow keys and others,
+         * which the keymap the search returns to reads in full; on
+         * its own, it just ends the search */
+        end_search();
+        rl_execute_next(c);
+        return 0;
+    }
+    if (*match != -1)
+        show(*match, s);
+    prompt();
+    return 0;
+}
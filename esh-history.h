@@ -0,0 +1,26 @@
+#ifndef __ESH_HISTORY_H
+#define __ESH_HISTORY_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Persistent command history.
+ *
+ * Every line typed at the prompt is appended to a per-host log,
+ * $ESH_HISTFILE or ~/.esh_history.<hostname>, which all esh instances
+ * on the host share.  Nothing is read at startup: the log is mapped
+ * and indexed the first time Ctrl-R is pressed, and Ctrl-R searches
+ * the mapping directly, newest first.  Up and down arrow step through
+ * the lines of the current session.
+ */
+
+#include <stdbool.h>
+
+/* Open the log and bind Ctrl-R to its search.  Returns false if there
+ * is no history, because $ESH_HISTFILE is empty or the log cannot be
+ * opened. */
+bool esh_history_init(void);
+
+/* Append line to the log and to the session's history. */
+void esh_history_add(const char *line);
+
+#endif //__ESH_HISTORY_H
@@ -0,0 +1,592 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Fork-free versions of echo, printf, test, true and false.
+ *
+ * Scripts run these thousands of times, and each run used to cost a
+ * fork and an exec for a few bytes of output.  Here they run in the
+ * shell itself and write straight to the file their command line
+ * redirects output to.  Only a pipeline that consists of just the
+ * command is run this way; in longer pipelines, the command has to
+ * run concurrently with the other stages and is started as a
+ * process as before.
+ *
+ * The shell does not keep exit statuses yet, so the status each of
+ * these computes is not used.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+#include "esh-sys-utils.h"
+#include "esh-builtins.h"
+
+/* Buffered output to a descriptor */
+struct out {
+    int fd;
+    size_t len;
+    char buf[8192];
+};
+
+static void
+out_flush(struct out *o)
+{
+    char *p = o->buf;
+    while (o->len > 0) {
+        ssize_t n = write(o->fd, p, o->len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            esh_sys_error("write: ");
+            break;
+        }
+        p += n;
+        o->len -= n;
+    }
+    o->len = 0;
+}
+
+static void
+out_write(struct out *o, const char *s, size_t len)
+{
+    while (len > 0) {
+        if (o->len == sizeof o->buf)
+            out_flush(o);
+        size_t n = sizeof o->buf - o->len;
+        if (n > len)
+            n = len;
+        memcpy(o->buf + o->len, s, n);
+        o->len += n;
+        s += n;
+        len -= n;
+    }
+}
+
+static void
+out_char(struct out *o, char c)
+{
+    out_write(o, &c, 1);
+}
+
+/* Output the escape sequence following a backslash at *p and advance
+ * *p past it.  Octal escapes are \NNN, or \0NNN if zero_octal is set,
+ * as echo has it.  Returns false for \c, which ends all output. */
+static bool
+out_escape(struct out *o, const char **p, bool zero_octal)
+{
+    const char *s = *p;
+    int c = *s++;
+    int n;
+
+    switch (c) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'c': *p = s; return false;
+    case 'e': c = '\033'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': break;
+    case 'x':
+        for (c = 0, n = 0; n < 2 && isxdigit((unsigned char) *s); n++, s++)
+            c = 16 * c + (*s <= '9' ? *s - '0' : (*s | 0x20) - 'a' + 10);
+        if (n == 0) {
+            out_write(o, "\\x", 2);
+            *p = s;
+            return true;
+        }
+        break;
+    default:
+        if (zero_octal ? c == '0' : (c >= '0' && c <= '7')) {
+            int value = zero_octal ? 0 : c - '0';
+            for (n = zero_octal ? 0 : 1; n < 3 && *s >= '0' && *s <= '7'; n++, s++)
+                value = 8 * value + *s - '0';
+            c = value;
+            break;
+        }
+        /* not an escape; output it unchanged */
+        out_char(o, '\\');
+        if (c == '\0')
+            s--;
+        else
+            out_char(o, c);
+        *p = s;
+        return true;
+    }
+    out_char(o, c);
+    *p = s;
+    return true;
+}
+
+/* echo [-neE] [arg ...] */
+static int
+echo_main(struct out *o, char **argv)
+{
+    bool newline = true, escapes = false;
+
+    /* like coreutils, accept options only if they are all valid */
+    for (argv++; *argv && (*argv)[0] == '-' && (*argv)[1]
+                 && strspn(*argv + 1, "neE") == strlen(*argv + 1); argv++) {
+        for (char *f = *argv + 1; *f; f++) {
+            if (*f == 'n')
+                newline = false;
+            else
+                escapes = *f == 'e';
+        }
+    }
+
+    for (char **arg = argv; *arg; arg++) {
+        if (arg != argv)
+            out_char(o, ' ');
+        if (!escapes) {
+            out_write(o, *arg, strlen(*arg));
+            continue;
+        }
+        for (const char *p = *arg; *p; ) {
+            if (*p != '\\') {
+                out_char(o, *p++);
+                continue;
+            }
+            p++;
+            if (!out_escape(o, &p, true))
+                return 0;
+        }
+    }
+    if (newline)
+        out_char(o, '\n');
+    return 0;
+}
+
+/* The argument of a printf conversion, converted for its type */
+union printf_value {
+    long long sval;             /* d, i */
+    unsigned long long uval;    /* o, u, x, X */
+    double dval;                /* e, E, f, F, g, G */
+    int cval;                   /* c */
+    const char *str;            /* s */
+};
+
+/* Format value with fmt, whose conversion is conv, into buf as
+ * snprintf does, and return the length of the whole result. */
+static int
+printf_format(char *buf, size_t size, const char *fmt, char conv,
+              union printf_value *value)
+{
+    switch (conv) {
+    case 'd': case 'i':
+        return snprintf(buf, size, fmt, value->sval);
+    case 'o': case 'u': case 'x': case 'X':
+        return snprintf(buf, size, fmt, value->uval);
+    case 'c':
+        return snprintf(buf, size, fmt, value->cval);
+    case 's':
+        return snprintf(buf, size, fmt, value->str);
+    default:
+        return snprintf(buf, size, fmt, value->dval);
+    }
+}
+
+/* Output one printf conversion, spec, which has the form
+ * %[flags][width][.precision]conversion, for argument arg. */
+static bool
+printf_convert(struct out *o, char *spec, size_t speclen, const char *arg)
+{
+    char conv = spec[speclen - 1];
+    char fmt[64], buf[512];
+    union printf_value value;
+    bool quoted = *arg == '\'' || *arg == '"';
+    char *end = NULL;
+
+    if (speclen + 3 > sizeof fmt)
+        return false;
+
+    errno = 0;
+    switch (conv) {
+    case 'd': case 'i':
+        snprintf(fmt, sizeof fmt, "%.*sll%c", (int) speclen - 1, spec, conv);
+        value.sval = quoted ? (unsigned char) arg[1] : strtoll(arg, &end, 0);
+        break;
+    case 'o': case 'u': case 'x': case 'X':
+        snprintf(fmt, sizeof fmt, "%.*sll%c", (int) speclen - 1, spec, conv);
+        value.uval = quoted ? (unsigned char) arg[1] : strtoull(arg, &end, 0);
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+        snprintf(fmt, sizeof fmt, "%.*s", (int) speclen, spec);
+        value.dval = strtod(arg, &end);
+        break;
+    case 'c':
+        /* an empty argument prints nothing, not a NUL */
+        if (*arg == '\0')
+            return true;
+        snprintf(fmt, sizeof fmt, "%.*s", (int) speclen, spec);
+        value.cval = *arg;
+        break;
+    case 's':
+        snprintf(fmt, sizeof fmt, "%.*s", (int) speclen, spec);
+        value.str = arg;
+        break;
+    default:
+        return false;
+    }
+
+    if (strchr("diouxXeEfFgG", conv) && *arg && !quoted
+            && (*end != '\0' || errno == ERANGE)) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        errno = 0;
+    }
+
+    /* a long argument, a wide field or a high precision may not fit buf */
+    int n = printf_format(buf, sizeof buf, fmt, conv, &value);
+    if (n >= (int) sizeof buf) {
+        char *big = malloc(n + 1);
+        if (big == NULL)
+            esh_sys_fatal_error("malloc: ");
+        printf_format(big, n + 1, fmt, conv, &value);
+        out_write(o, big, n);
+        free(big);
+    } else if (n > 0) {
+        out_write(o, buf, n);
+    }
+    return true;
+}
+
+/* Return the length of the conversion specification at p, which starts
+ * with '%' and has the form %[flags][width][.precision]conversion, or 0
+ * if printf_convert does not handle it, such as one with a '*' width, a
+ * length modifier, or %b or %q. */
+static size_t
+printf_spec_length(const char *p)
+{
+    size_t speclen = 1 + strspn(p + 1, "-+ #0");
+    speclen += strspn(p + speclen, "0123456789");
+    if (p[speclen] == '.') {
+        speclen++;
+        speclen += strspn(p + speclen, "0123456789");
+    }
+    if (p[speclen] == '\0' || !strchr("diouxXeEfFgGcs", p[speclen]))
+        return 0;
+    return speclen + 1;
+}
+
+/* Return true if printf_main handles every escape and conversion of
+ * the format in argv; printf(1) runs all other formats. */
+static bool
+printf_supported(char **argv)
+{
+    if (argv[1] == NULL)
+        return true;
+    for (const char *p = argv[1]; *p; p++) {
+        if (*p == '\\') {
+            /* out_escape does not know Unicode escapes */
+            if (p[1] == 'u' || p[1] == 'U')
+                return false;
+            if (p[1] != '\0')
+                p++;
+        } else if (*p == '%') {
+            size_t speclen = p[1] == '%' ? 2 : printf_spec_length(p);
+            if (speclen == 0)
+                return false;
+            p += speclen - 1;
+        }
+    }
+    return true;
+}
+
+/* printf format [arg ...]
+ * The format is reused as long as arguments remain. */
+static int
+printf_main(struct out *o, char **argv)
+{
+    if (argv[1] == NULL) {
+        fprintf(stderr, "printf: missing format\n");
+        return 1;
+    }
+
+    const char *format = argv[1];
+    char **args = argv + 2;
+    do {
+        bool consumed = false;
+        for (const char *p = format; *p; ) {
+            if (*p == '\\') {
+                p++;
+                if (!out_escape(o, &p, false))
+                    return 0;
+                continue;
+            }
+            if (*p != '%') {
+                out_char(o, *p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                out_char(o, '%');
+                p += 2;
+                continue;
+            }
+
+            size_t speclen = printf_spec_length(p);
+            if (speclen == 0) {
+                fprintf(stderr, "printf: %s: invalid conversion\n", p);
+                return 1;
+            }
+
+            const char *arg = "";
+            if (*args) {
+                arg = *args++;
+                consumed = true;
+            }
+            printf_convert(o, (char *) p, speclen, arg);
+            p += speclen;
+        }
+        if (!consumed)
+            break;
+    } while (*args);
+    return 0;
+}
+
+/* Parse an integer operand of test */
+static bool
+test_integer(const char *s, long long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        return false;
+    }
+    return true;
+}
+
+/* The binary operators test_eval knows */
+static const char *test_binops[] = {
+    "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL
+};
+
+static bool
+test_is_binop(const char *op)
+{
+    for (const char **b = test_binops; *b; b++)
+        if (strcmp(op, *b) == 0)
+            return true;
+    return false;
+}
+
+/* Return true if test_eval evaluates the expression of argc words as
+ * test(1) does.  -a, -o, parentheses, more than three words (but for a
+ * leading '!'), and operators such as -nt or -p are left to test(1). */
+static bool
+test_expr_supported(int argc, char **argv)
+{
+    /* with three words, a binary operator takes precedence over '!' */
+    if (argc == 3 && test_is_binop(argv[1]))
+        return strcmp(argv[0], "!") != 0;
+    if (argc > 1 && strcmp(argv[0], "!") == 0)
+        return test_expr_supported(argc - 1, argv + 1);
+    if (argc <= 1)
+        return true;
+    if (argc == 2) {
+        const char *op = argv[0];
+        return op[0] == '-' && op[1] != '\0' && op[2] == '\0'
+            && strchr("nzefdshLrwx", op[1]) != NULL;
+    }
+    return false;
+}
+
+/* Evaluate a test expression of argc words.
+ * Returns 0 if it is true, 1 if false, 2 on error. */
+static int
+test_eval(int argc, char **argv)
+{
+    struct stat st;
+
+    if (argc == 0)
+        return 1;
+    if (strcmp(argv[0], "!") == 0 && argc > 1) {
+        int r = test_eval(argc - 1, argv + 1);
+        return r == 2 ? 2 : !r;
+    }
+    if (argc == 1)
+        return argv[0][0] == '\0';
+
+    if (argc == 2) {
+        const char *op = argv[0], *arg = argv[1];
+        if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+            fprintf(stderr, "test: %s: unary operator expected\n", op);
+            return 2;
+        }
+        switch (op[1]) {
+        case 'n': return arg[0] == '\0';
+        case 'z': return arg[0] != '\0';
+        case 'e': return stat(arg, &st) != 0;
+        case 'f': return stat(arg, &st) != 0 || !S_ISREG(st.st_mode);
+        case 'd': return stat(arg, &st) != 0 || !S_ISDIR(st.st_mode);
+        case 's': return stat(arg, &st) != 0 || st.st_size == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) != 0 || !S_ISLNK(st.st_mode);
+        case 'r': return access(arg, R_OK) != 0;
+        case 'w': return access(arg, W_OK) != 0;
+        case 'x': return access(arg, X_OK) != 0;
+        }
+        fprintf(stderr, "test: %s: unary operator expected\n", op);
+        return 2;
+    }
+
+    if (argc == 3) {
+        const char *a = argv[0], *op = argv[1], *b = argv[2];
+        static const char *intops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+        long long x, y;
+
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+            return strcmp(a, b) != 0;
+        if (strcmp(op, "!=") == 0)
+            return strcmp(a, b) == 0;
+        for (int i = 0; i < 6; i++) {
+            if (strcmp(op, intops[i]))
+                continue;
+            if (!test_integer(a, &x) || !test_integer(b, &y))
+                return 2;
+            switch (i) {
+            case 0: return !(x == y);
+            case 1: return !(x != y);
+            case 2: return !(x < y);
+            case 3: return !(x <= y);
+            case 4: return !(x > y);
+            case 5: return !(x >= y);
+            }
+        }
+        fprintf(stderr, "test: %s: binary operator expected\n", op);
+        return 2;
+    }
+
+    fprintf(stderr, "test: too many arguments\n");
+    return 2;
+}
+
+/* Return true if test_main handles test expr, or [ expr ], in argv. */
+static bool
+test_supported(char **argv)
+{
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+
+    /* a missing ']' is reported by test_main */
+    if (strcmp(argv[0], "[") == 0 && strcmp(argv[argc - 1], "]") == 0)
+        argc--;
+    return test_expr_supported(argc - 1, argv + 1);
+}
+
+/* test expr, or [ expr ] */
+static int
+test_main(struct out *o, char **argv)
+{
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    return test_eval(argc - 1, argv + 1);
+}
+
+static int
+true_main(struct out *o, char **argv)
+{
+    return 0;
+}
+
+static int
+false_main(struct out *o, char **argv)
+{
+    return 1;
+}
+
+/* Run cmd in the shell: apply its redirections, then call fn.
+ * Returns false if cmd must run as a process instead, which it must
+ * if supported is given and returns false for its argv. */
+static bool
+run_inproc(struct esh_command *cmd, int (* fn)(struct out *, char **),
+           bool (* supported)(char **))
+{
+    struct esh_pipeline *pipe = cmd->pipeline;
+    static struct out out;
+    struct stat st;
+
+    /* the other stages of a pipeline need a concurrent process */
+    if (list_begin(&pipe->commands) != list_rbegin(&pipe->commands))
+        return false;
+
+    /* the utility itself runs what the fork-free version does not know */
+    if (supported != NULL && !supported(cmd->argv))
+        return false;
+
+    /* opening a FIFO blocks until it has a reader, which must not stop
+     * the shell */
+    if (cmd->iored_output && stat(cmd->iored_output, &st) == 0
+            && S_ISFIFO(st.st_mode))
+        return false;
+
+    /* so do redirections other than a file for stdin or stdout */
+    struct list_elem *e;
+    for (e = list_begin(&cmd->redirects); e != list_end(&cmd->redirects);
+         e = list_next(e)) {
+        struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+        bool file = r->op == ESH_REDIRECT_INPUT ? r->fd == 0
+                  : (r->op == ESH_REDIRECT_OUTPUT || r->op == ESH_REDIRECT_APPEND) && r->fd == 1;
+        if (!file)
+            return false;
+    }
+
+    /* none of these read their input, but a missing input file is
+     * still an error that prevents the command from running */
+    if (cmd->iored_input) {
+        int fd = open(cmd->iored_input, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            esh_sys_error("%s: ", cmd->iored_input);
+            return true;
+        }
+        close(fd);
+    }
+
+    out.fd = STDOUT_FILENO;
+    out.len = 0;
+    if (cmd->iored_output) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        flags |= cmd->append_to_output ? O_APPEND : O_TRUNC;
+        out.fd = open(cmd->iored_output, flags,
+                      S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+        if (out.fd == -1) {
+            esh_sys_error("%s: ", cmd->iored_output);
+            return true;
+        }
+    } else {
+        /* keep what the shell printed before in order */
+        fflush(stdout);
+    }
+
+    fn(&out, cmd->argv);
+    out_flush(&out);
+    if (out.fd != STDOUT_FILENO)
+        close(out.fd);
+    return true;
+}
+
+bool builtin_echo(struct esh_command *cmd) { return run_inproc(cmd, echo_main, NULL); }
+bool builtin_printf(struct esh_command *cmd) { return run_inproc(cmd, printf_main, printf_supported); }
+bool builtin_test(struct esh_command *cmd) { return run_inproc(cmd, test_main, test_supported); }
+bool builtin_true(struct esh_command *cmd) { return run_inproc(cmd, true_main, NULL); }
+bool builtin_false(struct esh_command *cmd) { return run_inproc(cmd, false_main, NULL); }
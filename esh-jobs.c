@@ -0,0 +1,244 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The job registry.
+ *
+ * Jobs are kept in a list in the order in which they were started,
+ * which is the order the 'jobs' command shows them in.  In addition,
+ *  - jobs are indexed by jid in a table of slots, where a job's jid
+ *    is its slot number.  The lowest free slot is handed out next.
+ *  - jobs are hashed by process group, and commands by pid, so that
+ *    a reaped child can be mapped to its command and job directly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "esh-sys-utils.h"
+#include "esh-jobs.h"
+
+/* List of current jobs */
+static struct list jobs;
+
+/* Jobs that were removed but not yet claimed via esh_jobs_pop_finished */
+static struct list finished;
+
+/* jid -> job.  Slot 0 is unused since job ids start at 1. */
+static struct esh_pipeline **jid_table;
+static int jid_table_size;
+static int lowest_free_jid;
+
+/* A hash table of pids, chained through list_elems embedded
+ * in the objects it indexes. */
+struct pid_table {
+    struct list *buckets;
+    size_t nbuckets;        /* always a power of 2 */
+    size_t count;
+    pid_t (*key)(struct list_elem *);
+};
+
+static pid_t
+pgrp_key(struct list_elem *e)
+{
+    return list_entry(e, struct esh_pipeline, pgrp_elem)->pgrp;
+}
+
+static pid_t
+pid_key(struct list_elem *e)
+{
+    return list_entry(e, struct esh_command, pid_elem)->pid;
+}
+
+static struct pid_table pgrp_table = { .key = pgrp_key };
+static struct pid_table pid_table = { .key = pid_key };
+
+static struct list *
+pid_table_bucket(struct pid_table *t, pid_t pid)
+{
+    /* Fibonacci hashing; pids are allocated sequentially. */
+    unsigned h = (unsigned) pid * 2654435769u;
+    return &t->buckets[(h >> 8) & (t->nbuckets - 1)];
+}
+
+static void
+pid_table_init(struct pid_table *t, size_t nbuckets)
+{
+    t->buckets = malloc(nbuckets * sizeof *t->buckets);
+    if (t->buckets == NULL)
+        esh_sys_fatal_error("malloc: ");
+    t->nbuckets = nbuckets;
+    t->count = 0;
+    for (size_t i = 0; i < nbuckets; i++)
+        list_init(&t->buckets[i]);
+}
+
+/* Double the number of buckets and rehash all entries. */
+static void
+pid_table_grow(struct pid_table *t)
+{
+    struct list *old = t->buckets;
+    size_t oldn = t->nbuckets;
+
+    pid_table_init(t, 2 * oldn);
+    for (size_t i = 0; i < oldn; i++) {
+        while (!list_empty(&old[i])) {
+            struct list_elem *e = list_pop_front(&old[i]);
+            list_push_back(pid_table_bucket(t, t->key(e)), e);
+            t->count++;
+        }
+    }
+    free(old);
+}
+
+static void
+pid_table_insert(struct pid_table *t, struct list_elem *e)
+{
+    if (t->count >= 2 * t->nbuckets)
+        pid_table_grow(t);
+    list_push_back(pid_table_bucket(t, t->key(e)), e);
+    t->count++;
+}
+
+static void
+pid_table_remove(struct pid_table *t, struct list_elem *e)
+{
+    list_remove(e);
+    t->count--;
+}
+
+static struct list_elem *
+pid_table_find(struct pid_table *t, pid_t pid)
+{
+    struct list *b = pid_table_bucket(t, pid);
+    for (struct list_elem *e = list_begin(b); e != list_end(b);
+         e = list_next(e)) {
+        if (t->key(e) == pid)
+            return e;
+    }
+    return NULL;
+}
+
+/* Initialize the registry. */
+void
+esh_jobs_init(void)
+{
+    list_init(&jobs);
+    list_init(&finished);
+    pid_table_init(&pgrp_table, 64);
+    pid_table_init(&pid_table, 64);
+    jid_table_size = 0;
+    lowest_free_jid = 1;
+}
+
+/* Return the list of current jobs */
+struct list *
+esh_jobs_list(void)
+{
+    return &jobs;
+}
+
+/* Register a new job, allocating and returning its job id. */
+int
+esh_jobs_add(struct esh_pipeline *pipe)
+{
+    int jid = lowest_free_jid;
+    while (jid < jid_table_size && jid_table[jid] != NULL)
+        jid++;
+
+    if (jid >= jid_table_size) {
+        int newsize = jid_table_size ? 2 * jid_table_size : 32;
+        jid_table = realloc(jid_table, newsize * sizeof *jid_table);
+        if (jid_table == NULL)
+            esh_sys_fatal_error("realloc: ");
+        for (int i = jid_table_size; i < newsize; i++)
+            jid_table[i] = NULL;
+        jid_table_size = newsize;
+    }
+
+    jid_table[jid] = pipe;
+    lowest_free_jid = jid + 1;
+
+    pipe->jid = jid;
+    pipe->pgrp = -1;
+    list_push_back(&jobs, &pipe->elem);
+    return jid;
+}
+
+/* Index the job by pipe->pgrp once its first command started. */
+void
+esh_jobs_set_pgrp(struct esh_pipeline *pipe)
+{
+    assert(pipe->pgrp > 0);
+    pid_table_insert(&pgrp_table, &pipe->pgrp_elem);
+}
+
+/* Index a command by cmd->pid once it has started. */
+void
+esh_jobs_add_command(struct esh_command *cmd)
+{
+    pid_table_insert(&pid_table, &cmd->pid_elem);
+}
+
+/* Drop a command that has terminated from the pid index. */
+void
+esh_jobs_remove_command(struct esh_command *cmd)
+{
+    pid_table_remove(&pid_table, &cmd->pid_elem);
+    cmd->pid = -1;
+}
+
+/* Remove a job from the registry and release its job id. */
+void
+esh_jobs_remove(struct esh_pipeline *pipe)
+{
+    assert(jid_table[pipe->jid] == pipe);
+
+    for (struct list_elem *e = list_begin(&pipe->commands);
+         e != list_end(&pipe->commands); e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (cmd->pid > 0)
+            esh_jobs_remove_command(cmd);
+    }
+    if (pipe->pgrp > 0)
+        pid_table_remove(&pgrp_table, &pipe->pgrp_elem);
+
+    jid_table[pipe->jid] = NULL;
+    if (pipe->jid < lowest_free_jid)
+        lowest_free_jid = pipe->jid;
+    list_remove(&pipe->elem);
+    list_push_back(&finished, &pipe->elem);
+}
+
+/* Return the next finished job, or NULL. */
+struct esh_pipeline *
+esh_jobs_pop_finished(void)
+{
+    if (list_empty(&finished))
+        return NULL;
+    return list_entry(list_pop_front(&finished), struct esh_pipeline, elem);
+}
+
+/* Return job corresponding to jid */
+struct esh_pipeline *
+esh_jobs_get_from_jid(int jid)
+{
+    if (jid <= 0 || jid >= jid_table_size)
+        return NULL;
+    return jid_table[jid];
+}
+
+/* Return job corresponding to pgrp */
+struct esh_pipeline *
+esh_jobs_get_from_pgrp(pid_t pgrp)
+{
+    struct list_elem *e = pid_table_find(&pgrp_table, pgrp);
+    return e ? list_entry(e, struct esh_pipeline, pgrp_elem) : NULL;
+}
+
+/* Return process corresponding to pid */
+struct esh_command *
+esh_jobs_get_cmd_from_pid(pid_t pid)
+{
+    struct list_elem *e = pid_table_find(&pid_table, pid);
+    return e ? list_entry(e, struct esh_command, pid_elem) : NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef __ESH_JOBS_H
+#define __ESH_JOBS_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The job registry.
+ *
+ * Keeps the list of current jobs in the order they were started,
+ * and indexes them so that a job can be found in O(1) by its job id
+ * or process group, and a command by its pid.  Job ids are allocated
+ * lowest-free-first, so ids of finished jobs are reused.
+ */
+
+#include <sys/types.h>
+#include "esh.h"
+
+/* Initialize the registry. */
+void esh_jobs_init(void);
+
+/* Return the list of current jobs */
+struct list/* <esh_pipeline> */ * esh_jobs_list(void);
+
+/* Register a new job, allocating and returning its job id.
+ * The pipeline's pgrp is not known yet. */
+int esh_jobs_add(struct esh_pipeline *pipe);
+
+/* Index the job by pipe->pgrp once its first command started. */
+void esh_jobs_set_pgrp(struct esh_pipeline *pipe);
+
+/* Index a command by cmd->pid once it has started. */
+void esh_jobs_add_command(struct esh_command *cmd);
+
+/* Drop a command that has terminated from the pid index. */
+void esh_jobs_remove_command(struct esh_command *cmd);
+
+/* Remove a job from the registry and release its job id.
+ * The job is added to the list of finished jobs. */
+void esh_jobs_remove(struct esh_pipeline *pipe);
+
+/* Return the next finished job, or NULL.  The caller owns it. */
+struct esh_pipeline * esh_jobs_pop_finished(void);
+
+/* Lookup functions.  Return NULL if not found. */
+struct esh_pipeline * esh_jobs_get_from_jid(int jid);
+struct esh_pipeline * esh_jobs_get_from_pgrp(pid_t pgrp);
+struct esh_command * esh_jobs_get_cmd_from_pid(pid_t pid);
+
+#endif //__ESH_JOBS_H
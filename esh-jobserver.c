@@ -0,0 +1,161 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * GNU make jobserver client and server.
+ *
+ * $MAKEFLAGS names the jobserver as --jobserver-auth=R,W, where R and
+ * W are inherited descriptors of the pipe, or, since make 4.4, as
+ * --jobserver-auth=fifo:PATH.  Older makes use --jobserver-fds=R,W.
+ *
+ * The shell must never block on the jobserver.  The descriptors it
+ * shares with make are in blocking mode, and setting O_NONBLOCK on
+ * them would change them for make as well, since a flag like that
+ * belongs to the open file description.  Instead, the shell reads
+ * through a description of its own, opened with O_NONBLOCK, of the
+ * same pipe (via /proc/self/fd) or fifo.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "esh-sys-utils.h"
+#include "esh-jobserver.h"
+
+static int read_fd = -1;            /* non-blocking, private to the shell */
+static int write_fd = -1;
+static bool implicit_free = true;   /* the shell's own slot is not in use */
+
+/* Open the pipe behind inherited descriptor fd for non-blocking reads. */
+static int
+reopen_nonblocking(int fd)
+{
+    char path[32];
+    snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+bool
+esh_jobserver_create(int n)
+{
+    int fds[2];
+    char makeflags[64];
+
+    /* makes started by the shell inherit these, so no O_CLOEXEC */
+    if (pipe(fds) == -1) {
+        esh_sys_error("jobserver: pipe: ");
+        return false;
+    }
+    for (int i = 1; i < n; i++) {
+        if (write(fds[1], "+", 1) != 1) {
+            esh_sys_error("jobserver: write: ");
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+    }
+
+    read_fd = reopen_nonblocking(fds[0]);
+    if (read_fd == -1) {
+        esh_sys_error("jobserver: ");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    write_fd = fds[1];
+
+    snprintf(makeflags, sizeof makeflags, " -j%d --jobserver-auth=%d,%d",
+             n, fds[0], fds[1]);
+    setenv("MAKEFLAGS", makeflags, 1);
+    return true;
+}
+
+/* Return the value of the last option 'name' in flags, up to the next
+ * blank, in a malloc'd string, or NULL. */
+static char *
+find_option(const char *flags, const char *name)
+{
+    const char *value = NULL;
+    for (const char *p = flags; (p = strstr(p, name)) != NULL; p += strlen(name))
+        value = p + strlen(name);
+    return value ? strndup(value, strcspn(value, " \t")) : NULL;
+}
+
+bool
+esh_jobserver_join(void)
+{
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (makeflags == NULL)
+        return false;
+
+    char *auth = find_option(makeflags, "--jobserver-auth=");
+    if (auth == NULL)
+        auth = find_option(makeflags, "--jobserver-fds=");
+    if (auth == NULL)
+        return false;
+
+    int rfd, wfd;
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        read_fd = open(auth + 5, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        write_fd = open(auth + 5, O_WRONLY | O_CLOEXEC);
+    } else if (sscanf(auth, "%d,%d", &rfd, &wfd) == 2
+               && fcntl(rfd, F_GETFD) != -1 && fcntl(wfd, F_GETFD) != -1) {
+        read_fd = reopen_nonblocking(rfd);
+        write_fd = wfd;
+    } else {
+        /* make did not pass the descriptors, e.g., no '+' in the recipe */
+        fprintf(stderr, "esh: jobserver %s not available, not joining\n", auth);
+    }
+    free(auth);
+
+    if (read_fd == -1 || write_fd == -1) {
+        if (read_fd != -1)
+            close(read_fd);
+        read_fd = write_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool
+esh_jobserver_active(void)
+{
+    return read_fd != -1;
+}
+
+int
+esh_jobserver_acquire(void)
+{
+    unsigned char token;
+
+    if (implicit_free) {
+        implicit_free = false;
+        return ESH_JOBSERVER_IMPLICIT;
+    }
+
+    ssize_t n;
+    do {
+        n = read(read_fd, &token, 1);
+    } while (n == -1 && errno == EINTR);
+    return n == 1 ? token : -1;
+}
+
+void
+esh_jobserver_release(int token)
+{
+    if (token == ESH_JOBSERVER_IMPLICIT) {
+        implicit_free = true;
+        return;
+    }
+
+    unsigned char byte = token;
+    ssize_t n;
+    do {
+        n = write(write_fd, &byte, 1);
+    } while (n == -1 && errno == EINTR);
+    if (n != 1)
+        esh_sys_error("jobserver: write: ");
+}
@@ -0,0 +1,40 @@
+#ifndef __ESH_JOBSERVER_H
+#define __ESH_JOBSERVER_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * GNU make jobserver client and server.
+ *
+ * A jobserver is a pipe (or named fifo) holding one byte per job slot.
+ * A client reads a byte before it starts a job and writes the same
+ * byte back once the job is done; every client also owns one implicit
+ * slot that is not in the pipe.  esh either joins the jobserver named
+ * in $MAKEFLAGS, or, with 'esh -j N', creates one with N slots and
+ * exports it in $MAKEFLAGS, so that makes started from esh share its
+ * slots.  Background jobs then take a slot each, and wait in the
+ * QUEUED state while none is free.
+ */
+
+#include <stdbool.h>
+
+/* The shell's implicit slot, which is not backed by a byte in the pipe */
+#define ESH_JOBSERVER_IMPLICIT 256
+
+/* Create a jobserver with n slots and export it in $MAKEFLAGS. */
+bool esh_jobserver_create(int n);
+
+/* Join the jobserver named in $MAKEFLAGS.  Returns false if there is
+ * none, or if its descriptors were not passed on to us. */
+bool esh_jobserver_join(void);
+
+/* Return true if esh created or joined a jobserver. */
+bool esh_jobserver_active(void);
+
+/* Take a slot without blocking.  Returns the token, to be passed to
+ * esh_jobserver_release() later, or -1 if no slot is free. */
+int esh_jobserver_acquire(void);
+
+/* Give back a slot taken with esh_jobserver_acquire(). */
+void esh_jobserver_release(int token);
+
+#endif //__ESH_JOBSERVER_H
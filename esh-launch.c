@@ -0,0 +1,399 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Launch engines that start a single command of a pipeline.
+ *
+ * The spawn engine uses posix_spawn(3).  glibc implements it with
+ * clone(CLONE_VM|CLONE_VFORK), so its cost does not depend on the
+ * size of the shell's address space.  Process group, signal mask,
+ * terminal handoff and descriptor setup are all expressed through
+ * spawn attributes and file actions.
+ *
+ * The fork engine is the traditional fork() + exec() path.  It is
+ * kept as a fallback and can be selected with 'esh -e fork'.
+ *
+ * A command that is to run in a cgroup of its own is started with
+ * clone3(CLONE_INTO_CGROUP), which places it there as it is created.
+ * posix_spawn can only do that from glibc 2.41 on; older ones make the
+ * spawn engine fork such commands instead.
+ *
+ * A redirection like '<&3' must not hand the command one of the
+ * shell's own descriptors, which are all close-on-exec.  The child
+ * checks for that before it copies one; posix_spawn cannot, so the
+ * spawn engine forks commands that copy a descriptor they may not have.
+ *
+ * The fork server engine ('esh -e server') is in esh-forkserver.c.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include "esh-sys-utils.h"
+#include "esh-launch.h"
+#include "esh-trace.h"
+
+extern char **environ;
+
+enum esh_launch_engine esh_launch_engine = ESH_ENGINE_SPAWN;
+
+/* Select engine by name.  Returns false if unknown. */
+bool
+esh_launch_set_engine(const char *name)
+{
+    if (!strcmp(name, "spawn"))
+        esh_launch_engine = ESH_ENGINE_SPAWN;
+    else if (!strcmp(name, "fork"))
+        esh_launch_engine = ESH_ENGINE_FORK;
+    else if (!strcmp(name, "server"))
+        esh_launch_engine = ESH_ENGINE_SERVER;
+    else
+        return false;
+    return true;
+}
+
+/* Initialize a launch description for argv. */
+void
+esh_launch_init(struct esh_launch *l, char **argv,
+                pid_t pgrp, bool foreground)
+{
+    l->argv = argv;
+    l->path = NULL;
+    l->pgrp = pgrp;
+    l->foreground = foreground;
+    l->exec_fd = -1;
+    l->execed = false;
+    l->cgroup_fd = -1;
+    l->nactions = 0;
+}
+
+static struct esh_fd_action *
+add_action(struct esh_launch *l, enum esh_fd_op op, int fd)
+{
+    assert(l->nactions < ESH_LAUNCH_MAX_ACTIONS);
+    struct esh_fd_action *a = &l->actions[l->nactions++];
+    a->op = op;
+    a->fd = fd;
+    return a;
+}
+
+/* Make fd in the child refer to srcfd. */
+void
+esh_launch_dup(struct esh_launch *l, int srcfd, int fd)
+{
+    add_action(l, ESH_FD_DUP, fd)->srcfd = srcfd;
+}
+
+/* Make fd in the child a copy of its own srcfd.  Unlike with
+ * esh_launch_dup, srcfd is looked up in the child, after the actions
+ * before this one, so that '>f 2>&1' copies f and not the shell's stdout.
+ * The two only differ for the fork server, which does not share the
+ * shell's descriptors. */
+void
+esh_launch_copy(struct esh_launch *l, int srcfd, int fd)
+{
+    add_action(l, ESH_FD_COPY, fd)->srcfd = srcfd;
+}
+
+/* Open path onto fd in the child. */
+void
+esh_launch_open(struct esh_launch *l, int fd,
+                const char *path, int flags, mode_t mode)
+{
+    struct esh_fd_action *a = add_action(l, ESH_FD_OPEN, fd);
+    a->path = path;
+    a->flags = flags;
+    a->mode = mode;
+}
+
+/* Close fd in the child. */
+void
+esh_launch_close(struct esh_launch *l, int fd)
+{
+    add_action(l, ESH_FD_CLOSE, fd);
+}
+
+/* Create a pipe for connecting two commands.
+ * pipe2() sets O_CLOEXEC atomically, so the parent's ends never leak
+ * into other children.  Pipes default to 64 KiB, which makes stages
+ * that move a lot of data context switch constantly; a larger size
+ * (up to /proc/sys/fs/pipe-max-size) lets them run in bigger bursts. */
+int
+esh_launch_pipe(int fds[2], int size)
+{
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return -1;
+
+    if (size > 0)
+        fcntl(fds[1], F_SETPIPE_SZ, size);
+    return 0;
+}
+
+/* Apply descriptor actions in a forked child.  Returns -1 on error. */
+static int
+apply_fd_actions(struct esh_launch *l)
+{
+    /* The fork server receives the sources of dups wherever it has room,
+     * which may be a descriptor that an earlier action replaces.  Move
+     * them above every descriptor the actions set. */
+    int maxfd = STDERR_FILENO;
+    for (int i = 0; i < l->nactions; i++)
+        if (l->actions[i].fd > maxfd)
+            maxfd = l->actions[i].fd;
+    for (int i = 0; i < l->nactions; i++) {
+        struct esh_fd_action *a = &l->actions[i];
+        if (a->op == ESH_FD_DUP && a->srcfd <= maxfd
+                && (a->srcfd = fcntl(a->srcfd, F_DUPFD_CLOEXEC, maxfd + 1)) == -1)
+            return -1;
+    }
+
+    for (int i = 0; i < l->nactions; i++) {
+        struct esh_fd_action *a = &l->actions[i];
+        switch (a->op) {
+        case ESH_FD_DUP:
+            if (dup2(a->srcfd, a->fd) == -1)
+                return -1;
+            break;
+
+        case ESH_FD_COPY: {
+            /* the shell's own descriptors are close-on-exec; the
+             * command would not have them, so it cannot copy them */
+            int flags = fcntl(a->srcfd, F_GETFD);
+            if (flags & FD_CLOEXEC)
+                errno = EBADF;
+            if (flags == -1 || flags & FD_CLOEXEC
+                    || dup2(a->srcfd, a->fd) == -1) {
+                esh_sys_error("%d: ", a->srcfd);
+                return -1;
+            }
+            break;
+        }
+
+        case ESH_FD_OPEN: {
+            int fd = open(a->path, a->flags, a->mode);
+            if (fd == -1) {
+                esh_sys_error("%s: ", a->path);
+                return -1;
+            }
+            if (fd != a->fd) {
+                if (dup2(fd, a->fd) == -1)
+                    return -1;
+                close(fd);
+            }
+            break;
+        }
+
+        case ESH_FD_CLOSE:
+            close(a->fd);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Child side of the fork and fork server engines.  Does not return. */
+void
+esh_launch_child(struct esh_launch *l, int ttyfd)
+{
+    if (setpgid(0, l->pgrp) == -1) {
+        esh_sys_error("setpgid: ");
+        _exit(EXIT_FAILURE);
+    }
+
+    if (l->foreground) {
+        esh_signal_block(SIGTTOU);
+        if (tcsetpgrp(ttyfd, getpgrp()) == -1)
+            esh_sys_error("tcsetpgrp: ");
+    }
+
+    if (apply_fd_actions(l) == -1)
+        _exit(EXIT_FAILURE);
+
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    if (l->path)
+        execv(l->path, l->argv);
+    else
+        execvp(l->argv[0], l->argv);
+    esh_sys_error("%s: Could not find command: ", l->argv[0]);
+    _exit(127);
+}
+
+pid_t
+esh_launch_clone(int flags, int cgroup_fd)
+{
+    if (cgroup_fd == -1)
+        return syscall(SYS_clone, flags | SIGCHLD, 0, 0, 0, 0);
+
+    /* clone3 wants no exit signal with CLONE_PARENT; the child gets
+     * the caller's, which is SIGCHLD for the fork server */
+    struct clone_args args = {
+        .flags = flags | CLONE_INTO_CGROUP,
+        .exit_signal = flags & CLONE_PARENT ? 0 : SIGCHLD,
+        .cgroup = cgroup_fd,
+    };
+    pid_t child = syscall(SYS_clone3, &args, sizeof args);
+    if (child != -1 || errno != ENOSYS)
+        return child;
+
+    /* Before Linux 5.7, move the child after the fact.  It may exec,
+     * and start others, before it is moved. */
+    child = syscall(SYS_clone, flags | SIGCHLD, 0, 0, 0, 0);
+    if (child > 0) {
+        int procs = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (procs == -1 || dprintf(procs, "%d", (int) child) < 0)
+            esh_sys_error("cgroup.procs: ");
+        if (procs != -1)
+            close(procs);
+    }
+    return child;
+}
+
+static pid_t
+launch_fork(struct esh_launch *l)
+{
+    pid_t child = l->cgroup_fd == -1 ? fork() : esh_launch_clone(0, l->cgroup_fd);
+    if (child == -1)
+        return -1;
+
+    if (child == 0)
+        esh_launch_child(l, l->foreground ? esh_sys_tty_getfd() : -1);
+
+    /* Also set the process group in the parent to avoid a race with
+     * subsequent commands joining it.  EACCES means the child already
+     * exec'd, in which case it has placed itself. */
+    uint64_t t = esh_trace_now();
+    if (setpgid(child, l->pgrp ? l->pgrp : child) == -1 && errno != EACCES)
+        esh_sys_error("setpgid: ");
+    esh_trace_complete("setpgid", t, child, NULL);
+
+    return child;
+}
+
+/* Return true if l copies a descriptor that its earlier actions did
+ * not set up, other than the standard ones every command inherits.
+ * Only the child can tell whether such a copy is valid. */
+static bool
+copies_unknown_fd(struct esh_launch *l)
+{
+    for (int i = 0; i < l->nactions; i++) {
+        struct esh_fd_action *a = &l->actions[i];
+        if (a->op != ESH_FD_COPY)
+            continue;
+        bool open = a->srcfd <= 2;
+        for (int j = 0; j < i; j++)
+            if (l->actions[j].fd == a->srcfd)
+                open = l->actions[j].op != ESH_FD_CLOSE;
+        if (!open)
+            return true;
+    }
+    return false;
+}
+
+/* Return true if l has the child open a file. */
+static bool
+opens_file(struct esh_launch *l)
+{
+    for (int i = 0; i < l->nactions; i++)
+        if (l->actions[i].op == ESH_FD_OPEN)
+            return true;
+    return false;
+}
+
+pid_t
+esh_launch_spawn(struct esh_launch *l)
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t empty;
+    pid_t child;
+
+    /* The shell waits while posix_spawn's child sets up, so that child
+     * must not open a file whose open may block, like a FIFO. */
+    if (copies_unknown_fd(l) || opens_file(l))
+        return launch_fork(l);
+
+#ifdef POSIX_SPAWN_SETCGROUP
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                  | POSIX_SPAWN_SETSIGMASK
+                                  | (l->cgroup_fd != -1 ? POSIX_SPAWN_SETCGROUP : 0));
+    if (l->cgroup_fd != -1)
+        posix_spawnattr_setcgroup_np(&attr, l->cgroup_fd);
+#else
+    if (l->cgroup_fd != -1)
+        return launch_fork(l);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                  | POSIX_SPAWN_SETSIGMASK);
+#endif
+    posix_spawnattr_setpgroup(&attr, l->pgrp);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigmask(&attr, &empty);
+
+    posix_spawn_file_actions_init(&actions);
+    if (l->foreground)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions,
+                                                 esh_sys_tty_getfd());
+
+    for (int i = 0; i < l->nactions; i++) {
+        struct esh_fd_action *a = &l->actions[i];
+        switch (a->op) {
+        case ESH_FD_DUP:
+        case ESH_FD_COPY:
+            posix_spawn_file_actions_adddup2(&actions, a->srcfd, a->fd);
+            break;
+        case ESH_FD_OPEN:
+            posix_spawn_file_actions_addopen(&actions, a->fd, a->path,
+                                             a->flags, a->mode);
+            break;
+        case ESH_FD_CLOSE:
+            posix_spawn_file_actions_addclose(&actions, a->fd);
+            break;
+        }
+    }
+
+    int rc;
+    if (l->path)
+        rc = posix_spawn(&child, l->path, &actions, &attr, l->argv, environ);
+    else
+        rc = posix_spawnp(&child, l->argv[0], &actions, &attr,
+                          l->argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    /* the shell was suspended until the child exec'd */
+    l->execed = true;
+    return child;
+}
+
+/* Start the command described by l using the current engine. */
+pid_t
+esh_launch(struct esh_launch *l)
+{
+    switch (esh_launch_engine) {
+    case ESH_ENGINE_FORK:
+        return launch_fork(l);
+    case ESH_ENGINE_SERVER:
+        return esh_forkserver_launch(l);
+    case ESH_ENGINE_SPAWN:
+    default:
+        return esh_launch_spawn(l);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef __ESH_LAUNCH_H
+#define __ESH_LAUNCH_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Launch engines that start a single command of a pipeline.
+ *
+ * A launch is described by a struct esh_launch: the argv to execute,
+ * the process group to join, whether the command gets the terminal,
+ * and an ordered list of descriptor actions (dup2, open, close) that
+ * must be applied in the child before exec.  Each engine translates
+ * this description into its own mechanism.
+ */
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+enum esh_launch_engine {
+    ESH_ENGINE_SPAWN,       /* posix_spawn(3), which uses CLONE_VFORK */
+    ESH_ENGINE_FORK,        /* classic fork(2) + exec */
+    ESH_ENGINE_SERVER,      /* fork server process, see esh-forkserver.c */
+};
+
+/* The engine used by esh_launch().  Defaults to ESH_ENGINE_SPAWN. */
+extern enum esh_launch_engine esh_launch_engine;
+
+/* Select engine by name ("spawn", "fork" or "server").  Returns false if unknown. */
+bool esh_launch_set_engine(const char *name);
+
+enum esh_fd_op {
+    ESH_FD_DUP,             /* dup2(srcfd, fd) */
+    ESH_FD_COPY,            /* dup2(srcfd, fd), where srcfd is the child's
+                               descriptor as the earlier actions left it */
+    ESH_FD_OPEN,            /* open(path, flags, mode) onto fd */
+    ESH_FD_CLOSE,           /* close(fd) */
+};
+
+/* A descriptor action applied in the child, in order, before exec. */
+struct esh_fd_action {
+    enum esh_fd_op op;
+    int fd;                 /* descriptor in the child */
+    int srcfd;              /* ESH_FD_DUP, ESH_FD_COPY: descriptor to
+                               duplicate */
+    const char *path;       /* ESH_FD_OPEN: file to open */
+    int flags;              /* ESH_FD_OPEN: open(2) flags */
+    mode_t mode;            /* ESH_FD_OPEN: creation mode */
+};
+
+/* Enough for both pipe ends and a command's redirections */
+#define ESH_LAUNCH_MAX_ACTIONS 16
+
+struct esh_launch {
+    char **argv;            /* NULL terminated argument vector */
+    const char *path;       /* file to exec, or NULL to search $PATH
+                               for argv[0] */
+    pid_t pgrp;             /* process group to join, 0 to lead a new one */
+    bool foreground;        /* hand the terminal to pgrp before exec */
+    int exec_fd;            /* close-on-exec descriptor the child holds
+                               until it execs, so that the shell can tell
+                               when it did, or -1 */
+    bool execed;            /* set by esh_launch() if the child had
+                               exec'd by the time it returned */
+    int cgroup_fd;          /* cgroup v2 directory to start the child in,
+                               or -1 for the shell's cgroup */
+    int nactions;
+    struct esh_fd_action actions[ESH_LAUNCH_MAX_ACTIONS];
+};
+
+/* Initialize a launch description for argv. */
+void esh_launch_init(struct esh_launch *l, char **argv,
+                     pid_t pgrp, bool foreground);
+
+/* Append a descriptor action.  */
+void esh_launch_dup(struct esh_launch *l, int srcfd, int fd);
+void esh_launch_copy(struct esh_launch *l, int srcfd, int fd);
+void esh_launch_open(struct esh_launch *l, int fd,
+                     const char *path, int flags, mode_t mode);
+void esh_launch_close(struct esh_launch *l, int fd);
+
+/* Create a pipe for connecting two commands.  Both ends are
+ * close-on-exec.  If size is non-zero, the pipe's capacity is set
+ * to at least size bytes; failure to do so is not an error.
+ * Returns -1 and sets errno if the pipe cannot be created. */
+int esh_launch_pipe(int fds[2], int size);
+
+/* Start the command described by l using the current engine.
+ * The child has been placed in its process group when this function
+ * returns.  Returns the child's pid, or -1 and sets errno if the
+ * command could not be started. */
+pid_t esh_launch(struct esh_launch *l);
+
+/* Engine entry points, for use by esh_launch() and by engines
+ * that fall back to another one. */
+pid_t esh_launch_spawn(struct esh_launch *l);
+pid_t esh_forkserver_launch(struct esh_launch *l);
+
+/* Fork a child as clone(flags | SIGCHLD) does, placing it in the
+ * cgroup v2 directory cgroup_fd unless that is -1.  Returns 0 in the
+ * child and the child's pid, or -1, in the parent, like fork(). */
+pid_t esh_launch_clone(int flags, int cgroup_fd);
+
+/* Set up a freshly forked child as described by l and exec it.
+ * ttyfd is the terminal to hand to the child's process group if
+ * l->foreground is set. */
+void esh_launch_child(struct esh_launch *l, int ttyfd) __attribute__((__noreturn__));
+
+/* Start the fork server.  Must be called early, while the shell is
+ * still small, since that determines the cost of every later fork.
+ * Returns false if the server could not be started. */
+bool esh_forkserver_start(void);
+
+#endif //__ESH_LAUNCH_H
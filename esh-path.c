@@ -0,0 +1,215 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Resolved-command cache.
+ *
+ * Without it, every command start searches $PATH from scratch, at the
+ * cost of one failed execve() per $PATH entry that precedes the one
+ * holding the command.  On network file systems that dominates the
+ * cost of starting a command.  With the cache, a hit costs a single
+ * stat() of the directory the command was found in.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "list.h"
+#include "esh-sys-utils.h"
+#include "esh-path.h"
+
+#define NBUCKETS 256
+
+struct path_entry {
+    struct list_elem elem;      /* Link element in bucket. */
+    char *name;                 /* Command name, as typed. */
+    char *path;                 /* Absolute file name. */
+    char *dir;                  /* $PATH directory it was found in. */
+    struct timespec dir_mtime;  /* Modification time of dir when found. */
+    unsigned hits;
+};
+
+static struct list buckets[NBUCKETS];
+static bool initialized;
+static char *cached_path_env;   /* $PATH the entries were resolved with */
+static unsigned long hits, misses;
+
+/* FNV-1a */
+static struct list *
+bucket(const char *name)
+{
+    unsigned h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    return &buckets[h % NBUCKETS];
+}
+
+static struct path_entry *
+find(const char *name)
+{
+    struct list *b = bucket(name);
+    for (struct list_elem *e = list_begin(b); e != list_end(b);
+         e = list_next(e)) {
+        struct path_entry *pe = list_entry(e, struct path_entry, elem);
+        if (!strcmp(pe->name, name))
+            return pe;
+    }
+    return NULL;
+}
+
+static void
+entry_free(struct path_entry *pe)
+{
+    list_remove(&pe->elem);
+    free(pe->name);
+    free(pe->path);
+    free(pe->dir);
+    free(pe);
+}
+
+/* Drop all entries if $PATH changed since they were resolved. */
+static void
+check_path_env(void)
+{
+    const char *env = getenv("PATH");
+    if (env == NULL)
+        env = "/bin:/usr/bin";
+
+    if (!initialized) {
+        for (int i = 0; i < NBUCKETS; i++)
+            list_init(&buckets[i]);
+        initialized = true;
+    } else if (!strcmp(env, cached_path_env)) {
+        return;
+    }
+
+    esh_path_forget_all();
+    free(cached_path_env);
+    cached_path_env = strdup(env);
+}
+
+static bool
+same_mtime(struct timespec *a, struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* Search $PATH for name.  On success, store the file found, the
+ * directory it is in and that directory's modification time. */
+static bool
+resolve(const char *name, char *file, char *dir, struct timespec *dir_mtime)
+{
+    const char *p = cached_path_env;
+
+    while (*p) {
+        const char *colon = strchrnul(p, ':');
+        struct stat st;
+
+        /* An empty entry means the current directory. */
+        snprintf(dir, PATH_MAX, "%.*s", (int) (colon - p), p);
+        if (dir[0] == '\0')
+            strcpy(dir, ".");
+        snprintf(file, PATH_MAX, "%s/%s", dir, name);
+
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode)
+                && access(file, X_OK) == 0 && stat(dir, &st) == 0) {
+            *dir_mtime = st.st_mtim;
+            return true;
+        }
+
+        p = *colon ? colon + 1 : colon;
+    }
+    return false;
+}
+
+/* Return the file to exec for command name, or NULL if not found. */
+const char *
+esh_path_lookup(const char *name)
+{
+    static char file[PATH_MAX];
+    char dir[PATH_MAX];
+    struct timespec dir_mtime;
+
+    if (strchr(name, '/'))
+        return name;
+
+    check_path_env();
+
+    struct path_entry *pe = find(name);
+    if (pe) {
+        /* A changed directory may have lost or gained the command. */
+        struct stat st;
+        if (stat(pe->dir, &st) == 0 && same_mtime(&st.st_mtim, &pe->dir_mtime)) {
+            hits++;
+            pe->hits++;
+            return pe->path;
+        }
+        entry_free(pe);
+    }
+
+    misses++;
+    if (!resolve(name, file, dir, &dir_mtime))
+        return NULL;
+
+    /* Relative $PATH entries depend on the current directory. */
+    if (dir[0] != '/')
+        return file;
+
+    pe = malloc(sizeof *pe);
+    if (pe == NULL)
+        esh_sys_fatal_error("malloc: ");
+    pe->name = strdup(name);
+    pe->path = strdup(file);
+    pe->dir = strdup(dir);
+    pe->dir_mtime = dir_mtime;
+    pe->hits = 1;
+    list_push_back(bucket(name), &pe->elem);
+    return pe->path;
+}
+
+/* Remove name from the cache. */
+bool
+esh_path_forget(const char *name)
+{
+    if (!initialized)
+        return false;
+
+    struct path_entry *pe = find(name);
+    if (pe == NULL)
+        return false;
+    entry_free(pe);
+    return true;
+}
+
+/* Remove all entries from the cache. */
+void
+esh_path_forget_all(void)
+{
+    if (!initialized)
+        return;
+
+    for (int i = 0; i < NBUCKETS; i++)
+        while (!list_empty(&buckets[i]))
+            entry_free(list_entry(list_front(&buckets[i]),
+                                  struct path_entry, elem));
+}
+
+/* Print the cache and its hit/miss counters to stdout. */
+void
+esh_path_print(void)
+{
+    if (initialized) {
+        printf("hits\tcommand\n");
+        for (int i = 0; i < NBUCKETS; i++) {
+            for (struct list_elem *e = list_begin(&buckets[i]);
+                 e != list_end(&buckets[i]); e = list_next(e)) {
+                struct path_entry *pe = list_entry(e, struct path_entry, elem);
+                printf("%4u\t%s\n", pe->hits, pe->path);
+            }
+        }
+    }
+    printf("%lu hits, %lu misses\n", hits, misses);
+}
@@ -0,0 +1,31 @@
+#ifndef __ESH_PATH_H
+#define __ESH_PATH_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Resolved-command cache.
+ *
+ * Maps command names to the absolute path found by searching $PATH,
+ * so that commands can be exec'd directly instead of having execvp()
+ * try every $PATH entry in turn.  An entry is revalidated against the
+ * modification time of the directory it was found in, and the whole
+ * cache is dropped when $PATH changes.
+ */
+
+#include <stdbool.h>
+
+/* Return the file to exec for command name, or NULL if it cannot
+ * be found.  Names that contain a '/' are returned unchanged.
+ * The result is valid until the next call. */
+const char * esh_path_lookup(const char *name);
+
+/* Remove name from the cache.  Returns false if it was not cached. */
+bool esh_path_forget(const char *name);
+
+/* Remove all entries from the cache. */
+void esh_path_forget_all(void);
+
+/* Print the cache and its hit/miss counters to stdout. */
+void esh_path_print(void);
+
+#endif //__ESH_PATH_H
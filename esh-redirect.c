@@ -0,0 +1,139 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Redirections, opened by the shell.
+ *
+ * '>' truncates, and every file is opened close-on-exec, so that it
+ * only reaches the command it is for, as a dup onto the descriptor
+ * the redirection names.  The descriptors are moved above the highest
+ * one the command's redirections name, so that none of the actions
+ * before a dup can replace its source.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "esh-sys-utils.h"
+#include "esh-redirect.h"
+
+_Static_assert(2 + ESH_MAX_REDIRECTS <= ESH_LAUNCH_MAX_ACTIONS,
+               "a command's pipe ends and redirections must fit into one launch");
+
+#define CREATE_MODE (S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR)
+
+/* Return the open(2) flags for a file redirection. */
+static int
+open_flags(struct esh_redirect *r)
+{
+    switch (r->op) {
+    case ESH_REDIRECT_APPEND:
+        return O_WRONLY | O_CREAT | O_APPEND;
+    case ESH_REDIRECT_OUTPUT:
+        return O_WRONLY | O_CREAT | O_TRUNC;
+    default:
+        return O_RDONLY;
+    }
+}
+
+/* Open r's file close-on-exec at a descriptor above floor.  Returns
+ * the descriptor, or -1 with errno set. */
+static int
+open_above(struct esh_redirect *r, int floor)
+{
+    int fd = open(r->path, open_flags(r) | O_CLOEXEC, CREATE_MODE);
+    if (fd == -1 || fd > floor)
+        return fd;
+
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, floor + 1);
+    /* EINVAL means floor is the last descriptor the limit allows */
+    if (moved == -1 && errno == EINVAL)
+        errno = EMFILE;
+    close(fd);
+    return moved;
+}
+
+bool
+esh_redirect_open(struct esh_command *cmd, struct esh_launch *l,
+                  struct esh_redirect_fds *fds)
+{
+    struct list_elem *e;
+    int floor = STDERR_FILENO;
+
+    for (e = list_begin(&cmd->redirects); e != list_end(&cmd->redirects);
+         e = list_next(e)) {
+        struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+        if (r->fd > floor)
+            floor = r->fd;
+    }
+
+    fds->n = 0;
+    for (e = list_begin(&cmd->redirects); e != list_end(&cmd->redirects);
+         e = list_next(e)) {
+        struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+        struct stat st;
+
+        switch (r->op) {
+        case ESH_REDIRECT_INPUT:
+        case ESH_REDIRECT_OUTPUT:
+        case ESH_REDIRECT_APPEND: {
+            /* the shell must not wait for the other end of a FIFO */
+            if (stat(r->path, &st) == 0 && S_ISFIFO(st.st_mode)) {
+                esh_launch_open(l, r->fd, r->path, open_flags(r), CREATE_MODE);
+                break;
+            }
+            int fd = open_above(r, floor);
+            if (fd == -1) {
+                esh_sys_error("%s: ", r->path);
+                esh_redirect_close(fds);
+                return false;
+            }
+            fds->fds[fds->n++] = fd;
+            esh_launch_dup(l, fd, r->fd);
+            break;
+        }
+
+        case ESH_REDIRECT_DUP:
+            esh_launch_copy(l, r->srcfd, r->fd);
+            break;
+
+        case ESH_REDIRECT_CLOSE:
+            esh_launch_close(l, r->fd);
+            break;
+        }
+    }
+    return true;
+}
+
+void
+esh_redirect_close(struct esh_redirect_fds *fds)
+{
+    for (int i = 0; i < fds->n; i++)
+        close(fds->fds[i]);
+    fds->n = 0;
+}
+
+bool
+esh_redirect_truncate(struct esh_command *cmd)
+{
+    struct list_elem *e;
+
+    for (e = list_begin(&cmd->redirects); e != list_end(&cmd->redirects);
+         e = list_next(e)) {
+        struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+        struct stat st;
+
+        /* a FIFO has nothing to truncate, and opening it would block */
+        if (r->op != ESH_REDIRECT_OUTPUT
+                || (stat(r->path, &st) == 0 && S_ISFIFO(st.st_mode)))
+            continue;
+        int fd = open(r->path, open_flags(r) | O_CLOEXEC, CREATE_MODE);
+        if (fd == -1) {
+            esh_sys_error("%s: ", r->path);
+            return false;
+        }
+        close(fd);
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __ESH_REDIRECT_H
+#define __ESH_REDIRECT_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The redirections of a command, turned into descriptor actions for
+ * esh_launch.
+ *
+ * The files a command redirects to are opened by the shell, before it
+ * starts the command, so that a file that cannot be opened keeps the
+ * command from being started at all, and the command gets descriptors
+ * that are ready to use.  Only FIFOs, whose open blocks until the
+ * other end is opened too, are left for the child to open.
+ */
+
+#include <stdbool.h>
+
+#include "esh.h"
+#include "esh-launch.h"
+
+/* The descriptors the shell opened for a command's redirections */
+struct esh_redirect_fds {
+    int n;
+    int fds[ESH_MAX_REDIRECTS];
+};
+
+/* Open the files cmd redirects to and append all of its redirections,
+ * in order, to l.  Returns false, with an error reported and nothing
+ * left open, if a file cannot be opened.  Otherwise the descriptors
+ * are in fds, to be closed with esh_redirect_close() once the command
+ * was started. */
+bool esh_redirect_open(struct esh_command *cmd, struct esh_launch *l,
+                       struct esh_redirect_fds *fds);
+
+/* Close the descriptors esh_redirect_open() opened. */
+void esh_redirect_close(struct esh_redirect_fds *fds);
+
+/* Create and truncate the files of cmd's '>' redirections, as starting
+ * cmd would, for commands that then append to them instead.  Returns
+ * false, with an error reported, if a file cannot be opened. */
+bool esh_redirect_truncate(struct esh_command *cmd);
+
+#endif //__ESH_REDIRECT_H
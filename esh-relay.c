@@ -0,0 +1,320 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The relay behind the |+ fan-out operator.
+ *
+ * The relay is forked from the shell and never execs, so it does not
+ * need a binary of its own.  It moves the data with tee(2) and
+ * splice(2), which only pass references to pipe buffers around, so
+ * the data is never copied through user space:
+ *
+ *  - tee(in, out, n) duplicates the first n bytes in 'in' into every
+ *    consumer's pipe but the last, without consuming them;
+ *  - splice(in, last, n) then moves those bytes into the last one.
+ *
+ * tee always starts at the front of 'in', so if a consumer's pipe
+ * fills up part way through a chunk, the rest of the chunk cannot be
+ * tee'd to it later.  Such a chunk is read into a buffer and written
+ * out the ordinary way instead, which only happens while a consumer
+ * falls behind.
+ *
+ * A consumer that exits is dropped (EPIPE); once all of them are
+ * gone, the relay exits, and the producer gets SIGPIPE as it would
+ * writing into any other pipe that nobody reads.
+ *
+ * A meter splices without blocking.  When there is nothing to move,
+ * it waits in poll(2) for whichever side holds it up: for input if
+ * its input pipe is empty, else for room in its output pipe.  Its
+ * stats are in a MAP_SHARED mapping that the shell set up before the
+ * meter was forked, so the shell can read them while the job runs.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "esh-sys-utils.h"
+#include "esh-launch.h"
+#include "esh-relay.h"
+#include "esh-trace.h"
+
+/* Most bytes moved in one round, which is the most a pipe can hold
+ * with the default /proc/sys/fs/pipe-max-size */
+#define CHUNK (1 << 20)
+
+/* For chunks that cannot be tee'd; only touched in the relay */
+static char buf[CHUNK];
+
+/* Write n bytes from buf to fd.  Returns false on error. */
+static bool
+write_all(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t k = write(fd, buf, n);
+        if (k == -1 && errno == EINTR)
+            continue;
+        if (k == -1)
+            return false;
+        buf += k;
+        n -= k;
+    }
+    return true;
+}
+
+/* Read exactly n bytes from fd into buf, or as many as there are. */
+static ssize_t
+read_all(int fd, char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        ssize_t k = read(fd, buf + done, n - done);
+        if (k == -1 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            break;
+        done += k;
+    }
+    return done;
+}
+
+/* Move n bytes from in to out with splice.  Returns false if out was
+ * closed; the bytes are then consumed from in all the same. */
+static bool
+splice_all(int in, int out, size_t n)
+{
+    while (n > 0) {
+        ssize_t k = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE);
+        if (k == -1 && errno == EINTR)
+            continue;
+        if (k <= 0) {
+            read_all(in, buf, n);
+            return false;
+        }
+        n -= k;
+    }
+    return true;
+}
+
+/* Relay everything from in to the outputs.  Does not return. */
+static void __attribute__((__noreturn__))
+relay(int in, int *outs, int nouts)
+{
+    ssize_t sent[nouts];
+
+    while (nouts > 0) {
+        int last = nouts - 1;
+        ssize_t n;
+
+        /* Wait for data; the first consumer decides how much this round
+         * moves.  A single consumer needs no tee at all. */
+        if (nouts == 1)
+            n = splice(in, NULL, outs[0], NULL, CHUNK, SPLICE_F_MOVE);
+        else
+            n = tee(in, outs[0], CHUNK, 0);
+        if (n == 0)
+            _exit(EXIT_SUCCESS);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EPIPE)
+                _exit(EXIT_FAILURE);
+            close(outs[0]);
+            outs[0] = outs[--nouts];
+            continue;
+        }
+        if (nouts == 1)
+            continue;
+
+        bool partial = false;
+        sent[0] = n;
+        for (int i = 1; i < last; i++) {
+            do {
+                sent[i] = tee(in, outs[i], n, 0);
+            } while (sent[i] == -1 && errno == EINTR);
+            if (sent[i] == -1 && errno != EPIPE)
+                _exit(EXIT_FAILURE);
+            if (sent[i] != -1 && sent[i] < n)
+                partial = true;
+        }
+
+        if (!partial) {
+            sent[last] = splice_all(in, outs[last], n) ? n : -1;
+        } else {
+            if (read_all(in, buf, n) != n)
+                _exit(EXIT_FAILURE);
+            for (int i = 1; i < last; i++)
+                if (sent[i] != -1 && !write_all(outs[i], buf + sent[i], n - sent[i]))
+                    sent[i] = -1;
+            sent[last] = write_all(outs[last], buf, n) ? n : -1;
+        }
+
+        /* drop the consumers that have gone away */
+        for (int i = last; i > 0; i--) {
+            if (sent[i] == -1) {
+                close(outs[i]);
+                outs[i] = outs[--nouts];
+            }
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Move everything from in to out, recording into stats.  Does not return. */
+static void __attribute__((__noreturn__))
+meter(int in, int out, struct esh_relay_stats *stats)
+{
+    struct pollfd input = { .fd = in, .events = POLLIN };
+    struct pollfd output = { .fd = out, .events = POLLOUT };
+
+    stats->started = now_ns();
+    for (;;) {
+        ssize_t n = splice(in, NULL, out, NULL, CHUNK,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            stats->bytes += n;
+            continue;
+        }
+        if (n == 0)
+            break;
+        if (errno == EINTR)
+            continue;
+        /* EPIPE: the reader is gone */
+        if (errno != EAGAIN)
+            break;
+
+        uint64_t t = now_ns();
+        if (poll(&input, 1, 0) == 0) {
+            poll(&input, 1, -1);
+            stats->input_wait += now_ns() - t;
+        } else {
+            poll(&output, 1, -1);
+            stats->output_wait += now_ns() - t;
+        }
+    }
+    stats->finished = now_ns();
+    _exit(EXIT_SUCCESS);
+}
+
+/* Close every descriptor above stderr but in and the outputs, which
+ * would otherwise keep the shell's other pipes open. */
+static void
+close_others(int in, const int *outs, int nouts)
+{
+    int max = in;
+    for (int i = 0; i < nouts; i++)
+        if (outs[i] > max)
+            max = outs[i];
+
+    for (int fd = 3; fd < max; fd++) {
+        bool keep = fd == in;
+        for (int i = 0; i < nouts && !keep; i++)
+            keep = fd == outs[i];
+        if (!keep)
+            close(fd);
+    }
+    close_range(max + 1, ~0U, 0);
+}
+
+/* Fork a relay from in to outs.  Returns 0 in the relay, once it is
+ * set up, and its pid, or -1, in the shell. */
+static pid_t
+fork_relay(int in, const int *outs, int nouts, pid_t pgrp, int cgroup_fd)
+{
+    pid_t child = esh_launch_clone(0, cgroup_fd);
+    if (child == -1)
+        return -1;
+
+    if (child == 0) {
+        setpgid(0, pgrp);
+        close_others(in, outs, nouts);
+
+        /* like a command, the relay stops and dies with its job */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        return 0;
+    }
+
+    /* As for any command, also set the process group here, so that
+     * the commands started next can join it. */
+    uint64_t t = esh_trace_now();
+    if (setpgid(child, pgrp ? pgrp : child) == -1 && errno != ESRCH)
+        esh_sys_error("setpgid: ");
+    esh_trace_complete("setpgid", t, child, NULL);
+    return child;
+}
+
+pid_t
+esh_relay_start(int in, const int *outs, int nouts, pid_t pgrp, int cgroup_fd)
+{
+    pid_t child = fork_relay(in, outs, nouts, pgrp, cgroup_fd);
+    if (child == 0) {
+        int myouts[nouts];
+        for (int i = 0; i < nouts; i++)
+            myouts[i] = outs[i];
+        relay(in, myouts, nouts);
+    }
+    return child;
+}
+
+pid_t
+esh_relay_meter(int in, int out, pid_t pgrp, int cgroup_fd,
+                struct esh_relay_stats *stats)
+{
+    pid_t child = fork_relay(in, &out, 1, pgrp, cgroup_fd);
+    if (child == 0)
+        meter(in, out, stats);
+    return child;
+}
+
+struct esh_relay_stats *
+esh_relay_stats_create(int n)
+{
+    /* anonymous memory is zeroed */
+    void *stats = mmap(NULL, n * sizeof(struct esh_relay_stats),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return stats == MAP_FAILED ? NULL : stats;
+}
+
+void
+esh_relay_stats_free(struct esh_relay_stats *stats, int n)
+{
+    munmap(stats, n * sizeof(struct esh_relay_stats));
+}
+
+void
+esh_relay_stats_print(FILE *out, const char *from, const char *to,
+                      struct esh_relay_stats *stats)
+{
+    uint64_t started = stats->started;
+    uint64_t finished = stats->finished;
+    double mb = stats->bytes / 1048576.0;
+
+    /* a meter that has not started yet has nothing to show */
+    if (started == 0)
+        return;
+    double seconds = ((finished ? finished : now_ns()) - started) / 1e9;
+    fprintf(out, "    %s | %s: %.1fM in %.3fs, %.1fM/s, waited %.3fs for %s, %.3fs for %s\n",
+            from, to, mb, seconds, seconds > 0 ? mb / seconds : 0,
+            stats->input_wait / 1e9, from, stats->output_wait / 1e9, to);
+}
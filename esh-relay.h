@@ -0,0 +1,57 @@
+#ifndef __ESH_RELAY_H
+#define __ESH_RELAY_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The relay behind the |+ fan-out operator.
+ *
+ * In 'producer |+ (a) (b)', the producer writes into a pipe that a
+ * relay process reads, and the relay writes everything it reads into
+ * one pipe per consumer.  The relay is part of the job like any of
+ * its commands, and appears in it as a command named "|+".
+ *
+ * With $ESH_PIPESTAT set, a meter, which is a relay with a single
+ * output, is put on each pipe between two commands.  It counts the
+ * bytes that pass and how long it waits for the command writing into
+ * the pipe and for the one reading from it.  Meters are not commands
+ * of the job, but run in its process group.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/* What a meter saw, in memory shared with the shell.  Times are
+ * CLOCK_MONOTONIC nanoseconds. */
+struct esh_relay_stats {
+    atomic_uint_fast64_t bytes;         /* moved so far */
+    atomic_uint_fast64_t input_wait;    /* spent waiting for input */
+    atomic_uint_fast64_t output_wait;   /* spent waiting for room in the output */
+    atomic_uint_fast64_t started;       /* when the meter started */
+    atomic_uint_fast64_t finished;      /* when it was done, 0 until then */
+};
+
+/* Start a relay from descriptor in to the nouts descriptors in outs,
+ * in process group pgrp (0 to lead a new one) and, unless cgroup_fd
+ * is -1, in that cgroup.  The relay exits once in is at end of file,
+ * or all outputs are closed.  Returns its pid, or -1 with errno set. */
+pid_t esh_relay_start(int in, const int *outs, int nouts,
+                      pid_t pgrp, int cgroup_fd);
+
+/* Start a meter from in to out that records into stats, which must
+ * come from esh_relay_stats_create().  Otherwise like esh_relay_start. */
+pid_t esh_relay_meter(int in, int out, pid_t pgrp, int cgroup_fd,
+                      struct esh_relay_stats *stats);
+
+/* Allocate n zeroed stats that meters started later can write to,
+ * or return NULL.  Release them with esh_relay_stats_free(). */
+struct esh_relay_stats *esh_relay_stats_create(int n);
+void esh_relay_stats_free(struct esh_relay_stats *stats, int n);
+
+/* Print what the meter on the pipe from command 'from' to command 'to'
+ * saw so far to out. */
+void esh_relay_stats_print(FILE *out, const char *from, const char *to,
+                           struct esh_relay_stats *stats);
+
+#endif //__ESH_RELAY_H
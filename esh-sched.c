@@ -0,0 +1,188 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Admission control for background jobs.
+ *
+ * The readings come from /proc and are sampled at most every
+ * SAMPLE_INTERVAL_MS, so that admitting a burst of jobs - say, 500
+ * background commands pasted at once - does not read /proc 500 times.
+ * PSI's 10-second average lags behind a burst anyway; the limit on
+ * running jobs is what holds the first wave back.
+ *
+ * Kernels without PSI have no /proc/pressure; the pressure limits are
+ * then never exceeded.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esh-sched.h"
+
+#define SAMPLE_INTERVAL_MS 50
+
+struct esh_sched_limits esh_sched_limits;
+
+static struct {
+    struct timespec when;
+    double load;
+    double cpu_pressure;
+    double memory_pressure;
+    long available_kb;          /* -1 if unknown */
+} sample;
+
+void
+esh_sched_init(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1)
+        ncpus = 1;
+
+    esh_sched_limits.jobs = 4 * ncpus;
+    esh_sched_limits.load = 0;
+    esh_sched_limits.cpu_pressure = 0;
+    esh_sched_limits.memory_pressure = 50;
+    esh_sched_limits.available_kb = 0;
+}
+
+/* Return the 'some avg10' value from a /proc/pressure file, or 0. */
+static double
+read_pressure(const char *path)
+{
+    double avg10 = 0;
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+        avg10 = 0;
+    fclose(f);
+    return avg10;
+}
+
+/* Return MemAvailable from /proc/meminfo in kB, or -1. */
+static long
+read_available(void)
+{
+    char line[128];
+    long kb = -1;
+    FILE *f = fopen("/proc/meminfo", "re");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof line, f))
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+            break;
+    fclose(f);
+    return kb;
+}
+
+/* Refresh the readings the limits need, if they are old. */
+static void
+update_sample(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long age_ms = (now.tv_sec - sample.when.tv_sec) * 1000
+                + (now.tv_nsec - sample.when.tv_nsec) / 1000000;
+    if (sample.when.tv_sec != 0 && age_ms < SAMPLE_INTERVAL_MS)
+        return;
+
+    sample.when = now;
+    if (esh_sched_limits.load > 0 && getloadavg(&sample.load, 1) != 1)
+        sample.load = 0;
+    if (esh_sched_limits.cpu_pressure > 0)
+        sample.cpu_pressure = read_pressure("/proc/pressure/cpu");
+    if (esh_sched_limits.memory_pressure > 0)
+        sample.memory_pressure = read_pressure("/proc/pressure/memory");
+    if (esh_sched_limits.available_kb > 0)
+        sample.available_kb = read_available();
+}
+
+bool
+esh_sched_admit(int running)
+{
+    struct esh_sched_limits *l = &esh_sched_limits;
+
+    if (l->jobs > 0 && running >= l->jobs)
+        return false;
+
+    update_sample();
+    if (l->load > 0 && sample.load >= l->load)
+        return false;
+    if (l->cpu_pressure > 0 && sample.cpu_pressure >= l->cpu_pressure)
+        return false;
+    if (l->memory_pressure > 0 && sample.memory_pressure >= l->memory_pressure)
+        return false;
+    if (l->available_kb > 0 && sample.available_kb != -1
+            && sample.available_kb < l->available_kb)
+        return false;
+    return true;
+}
+
+/* Parse a size in kB, with an optional k, M or G suffix. */
+static bool
+parse_kb(const char *value, long *kb)
+{
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || v < 0)
+        return false;
+    switch (*end) {
+    case 'G': case 'g': v *= 1024;      /* fall through */
+    case 'M': case 'm': v *= 1024;      /* fall through */
+    case 'k': case 'K': case '\0': break;
+    default: return false;
+    }
+    *kb = v;
+    return true;
+}
+
+bool
+esh_sched_set(const char *name, const char *value)
+{
+    struct esh_sched_limits *l = &esh_sched_limits;
+    char *end;
+
+    if (!strcmp(name, "available"))
+        return parse_kb(value, &l->available_kb);
+
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0' || v < 0)
+        return false;
+
+    if (!strcmp(name, "jobs"))
+        l->jobs = v;
+    else if (!strcmp(name, "load"))
+        l->load = v;
+    else if (!strcmp(name, "cpu"))
+        l->cpu_pressure = v;
+    else if (!strcmp(name, "memory"))
+        l->memory_pressure = v;
+    else
+        return false;
+
+    /* readings for a newly enabled limit are taken at the next check */
+    sample.when.tv_sec = 0;
+    return true;
+}
+
+void
+esh_sched_print(int running)
+{
+    struct esh_sched_limits *l = &esh_sched_limits;
+    double load;
+    long available = read_available();
+
+    if (getloadavg(&load, 1) != 1)
+        load = 0;
+
+    printf("limit\t\tvalue\tnow\n");
+    printf("jobs\t\t%d\t%d\n", l->jobs, running);
+    printf("load\t\t%.2f\t%.2f\n", l->load, load);
+    printf("cpu\t\t%.2f%%\t%.2f%%\n", l->cpu_pressure,
+           read_pressure("/proc/pressure/cpu"));
+    printf("memory\t\t%.2f%%\t%.2f%%\n", l->memory_pressure,
+           read_pressure("/proc/pressure/memory"));
+    printf("available\t%ldk\t%ldk\n", l->available_kb, available);
+}
@@ -0,0 +1,41 @@
+#ifndef __ESH_SCHED_H
+#define __ESH_SCHED_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Admission control for background jobs.
+ *
+ * A background job is started only while the machine has room for it:
+ * fewer than a given number of jobs are running, and the load average,
+ * CPU and memory pressure (PSI, see /proc/pressure) and available
+ * memory are within their limits.  Jobs that are not admitted wait in
+ * the QUEUED state, and are admitted highest priority first as room
+ * frees up.  A limit of 0 is not checked.
+ */
+
+#include <stdbool.h>
+
+struct esh_sched_limits {
+    int jobs;                   /* running jobs */
+    double load;                /* 1-minute load average */
+    double cpu_pressure;        /* % of time some task waited for a CPU, */
+    double memory_pressure;     /* or for memory, over the last 10s */
+    long available_kb;          /* least MemAvailable, in kB */
+};
+
+extern struct esh_sched_limits esh_sched_limits;
+
+/* Set the default limits, which depend on the number of CPUs. */
+void esh_sched_init(void);
+
+/* Return true if one more job may start while 'running' jobs run. */
+bool esh_sched_admit(int running);
+
+/* Set the limit called name ("jobs", "load", "cpu", "memory" or
+ * "available") from value.  Returns false if either is invalid. */
+bool esh_sched_set(const char *name, const char *value);
+
+/* Print the limits and the current readings to stdout. */
+void esh_sched_print(int running);
+
+#endif //__ESH_SCHED_H
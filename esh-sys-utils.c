@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <assert.h>
+#include <sys/signalfd.h>
 
 #include "esh-sys-utils.h"
 
@@ -179,3 +180,20 @@ esh_signal_sethandler(int sig, sa_sigaction_t handler)
     if (sigaction(sig, &sa, NULL) != 0)
         esh_sys_fatal_error("sigaction failed for signal %d", sig);
 }
+
+/* Block signal 'sig' and return a non-blocking signalfd(2) that
+ * becomes readable when it is pending. */
+int
+esh_signal_fd(int sig)
+{
+    sigset_t mask;
+
+    esh_signal_block(sig);
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        esh_sys_fatal_error("signalfd failed for signal %d", sig);
+    return fd;
+}
@@ -56,4 +56,8 @@ typedef void (*sa_sigaction_t)(int, siginfo_t *, void *);
 /* Install signal handler for signal 'sig' */
 void esh_signal_sethandler(int sig, sa_sigaction_t handler);
 
+/* Block signal 'sig' and return a non-blocking signalfd(2) that
+ * becomes readable when it is pending. */
+int esh_signal_fd(int sig);
+
 #endif //__ESH_SYS_UTILS_H
@@ -0,0 +1,275 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Trace events in the Chrome trace event format.
+ *
+ * Events are recorded by the shell's main thread into a ring buffer
+ * and written to the trace file by a background thread.  The buffer
+ * has a single producer and a single consumer, so the two only need
+ * to agree on 'head' and 'tail': the shell fills a slot before it
+ * publishes it by advancing head, and the writer only advances tail
+ * once it is done with a slot.  Neither ever waits for the other.
+ * If the writer falls behind and the buffer is full, events are
+ * dropped and counted rather than blocking the shell.
+ *
+ * The file uses the JSON array format, one event per line.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "esh-sys-utils.h"
+#include "esh-trace.h"
+
+#define RING_SIZE   8192            /* must be a power of 2 */
+#define DETAIL_MAX  48
+#define FLUSH_INTERVAL_MS 50
+
+struct trace_event {
+    const char *name;               /* a string constant */
+    char ph;                        /* phase: 'X', 'i', 'B', 'E' or 'M' */
+    pid_t tid;
+    uint64_t ts;                    /* nanoseconds, CLOCK_MONOTONIC */
+    uint64_t dur;
+    char detail[DETAIL_MAX];
+};
+
+bool esh_trace_enabled;
+
+static struct trace_event ring[RING_SIZE];
+static atomic_uint_fast64_t head;   /* next slot to fill, written by shell */
+static atomic_uint_fast64_t tail;   /* next slot to write, written by writer */
+static atomic_bool stopping;
+static unsigned long dropped;
+
+static FILE *trace_file;
+static pthread_t writer;
+static pid_t shell_pid;
+static bool first_event = true;
+
+static uint64_t
+to_ns(const struct timespec *t)
+{
+    return (uint64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+uint64_t
+esh_trace_now(void)
+{
+    struct timespec now;
+    if (!esh_trace_enabled)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return to_ns(&now);
+}
+
+/* Claim the next slot, or return NULL if the ring is full. */
+static struct trace_event *
+reserve(void)
+{
+    uint_fast64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    uint_fast64_t t = atomic_load_explicit(&tail, memory_order_acquire);
+    if (h - t == RING_SIZE) {
+        dropped++;
+        return NULL;
+    }
+    return &ring[h & (RING_SIZE - 1)];
+}
+
+/* Make the slot returned by reserve() visible to the writer. */
+static void
+publish(void)
+{
+    atomic_fetch_add_explicit(&head, 1, memory_order_release);
+}
+
+static void
+record(const char *name, char ph, pid_t tid, uint64_t ts, uint64_t dur,
+       const char *detail)
+{
+    struct trace_event *ev = reserve();
+    if (ev == NULL)
+        return;
+    ev->name = name;
+    ev->ph = ph;
+    ev->tid = tid;
+    ev->ts = ts;
+    ev->dur = dur;
+    snprintf(ev->detail, sizeof ev->detail, "%s", detail ? detail : "");
+    publish();
+}
+
+void
+esh_trace_complete(const char *name, uint64_t start, pid_t tid,
+                   const char *detail)
+{
+    if (!esh_trace_enabled)
+        return;
+    uint64_t now = esh_trace_now();
+    record(name, 'X', tid, start, now - start, detail);
+}
+
+void
+esh_trace_span(const char *name, const struct timespec *from,
+               const struct timespec *to, pid_t tid, const char *detail)
+{
+    if (!esh_trace_enabled)
+        return;
+    record(name, 'X', tid, to_ns(from), to_ns(to) - to_ns(from), detail);
+}
+
+void
+esh_trace_instant(const char *name, pid_t tid, const char *detail)
+{
+    if (!esh_trace_enabled)
+        return;
+    record(name, 'i', tid, esh_trace_now(), 0, detail);
+}
+
+void
+esh_trace_name_track(pid_t tid, const char *name)
+{
+    if (!esh_trace_enabled)
+        return;
+    record("thread_name", 'M', tid, 0, 0, name);
+}
+
+void
+esh_trace_begin(const char *name, const char *detail)
+{
+    if (!esh_trace_enabled)
+        return;
+    record(name, 'B', 0, esh_trace_now(), 0, detail);
+}
+
+void
+esh_trace_end(const char *name)
+{
+    if (!esh_trace_enabled)
+        return;
+    record(name, 'E', 0, esh_trace_now(), 0, NULL);
+}
+
+/* Write s as the contents of a JSON string. */
+static void
+write_escaped(const char *s)
+{
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(trace_file, "\\%c", *s);
+        else if ((unsigned char) *s < ' ')
+            fprintf(trace_file, "\\u%04x", *s);
+        else
+            putc(*s, trace_file);
+    }
+}
+
+static void
+write_event(struct trace_event *ev)
+{
+    fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d",
+            first_event ? "" : ",\n", ev->name, ev->ph, (int) shell_pid,
+            (int) (ev->tid ? ev->tid : shell_pid));
+    first_event = false;
+
+    if (ev->ph != 'M')
+        fprintf(trace_file, ",\"ts\":%.3f", ev->ts / 1e3);
+    if (ev->ph == 'X')
+        fprintf(trace_file, ",\"dur\":%.3f", ev->dur / 1e3);
+    if (ev->ph == 'i')
+        fprintf(trace_file, ",\"s\":\"t\"");
+    if (ev->detail[0]) {
+        fprintf(trace_file, ",\"args\":{\"%s\":\"",
+                ev->ph == 'M' ? "name" : "detail");
+        write_escaped(ev->detail);
+        fprintf(trace_file, "\"}");
+    }
+    putc('}', trace_file);
+}
+
+/* Write all events recorded so far.  Returns false if there were none. */
+static bool
+drain(void)
+{
+    uint_fast64_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    uint_fast64_t h = atomic_load_explicit(&head, memory_order_acquire);
+    if (t == h)
+        return false;
+
+    for (; t != h; t++) {
+        write_event(&ring[t & (RING_SIZE - 1)]);
+        atomic_store_explicit(&tail, t + 1, memory_order_release);
+    }
+    fflush(trace_file);
+    return true;
+}
+
+static void *
+writer_loop(void *arg)
+{
+    struct timespec interval = { 0, FLUSH_INTERVAL_MS * 1000000 };
+
+    while (!atomic_load(&stopping)) {
+        if (!drain())
+            nanosleep(&interval, NULL);
+    }
+    drain();
+    return NULL;
+}
+
+void
+esh_trace_init(void)
+{
+    const char *path = getenv("ESH_TRACE");
+    if (path == NULL || *path == '\0')
+        return;
+
+    trace_file = fopen(path, "we");
+    if (trace_file == NULL) {
+        esh_sys_error("%s: ", path);
+        return;
+    }
+    fputs("[\n", trace_file);
+
+    shell_pid = getpid();
+    esh_trace_enabled = true;
+    record("process_name", 'M', 0, 0, 0, "esh");
+    record("thread_name", 'M', 0, 0, 0, "shell");
+
+    /* The writer must not take signals meant for the shell: a SIGCHLD
+     * delivered to it would never reach the shell's signalfd.  A new
+     * thread inherits the creator's mask, so block everything for it. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int rc = pthread_create(&writer, NULL, writer_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "esh: cannot start trace writer: %s\n", strerror(rc));
+        esh_trace_enabled = false;
+        fclose(trace_file);
+        trace_file = NULL;
+        return;
+    }
+    atexit(esh_trace_finish);
+}
+
+void
+esh_trace_finish(void)
+{
+    if (trace_file == NULL)
+        return;
+
+    esh_trace_enabled = false;
+    atomic_store(&stopping, true);
+    pthread_join(writer, NULL);
+    if (dropped)
+        fprintf(stderr, "esh: %lu trace events dropped\n", dropped);
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
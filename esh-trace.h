@@ -0,0 +1,60 @@
+#ifndef __ESH_TRACE_H
+#define __ESH_TRACE_H
+/*
+ * esh - the 'extensible' shell.
+ *
+ * Trace events in the Chrome trace event format.
+ *
+ * If $ESH_TRACE names a file, the shell records what it spends its
+ * time on - waiting in readline, parsing, plugin hooks, launching,
+ * terminal handoff, waiting for and reaping jobs - and writes it to
+ * that file.  The file loads in Perfetto (ui.perfetto.dev) and in
+ * chrome://tracing.  Shell events appear on the shell's track, those
+ * of a command on a track of their own named after the command.
+ *
+ * Recording an event only stores it in a ring buffer; a background
+ * thread formats and writes it.  When tracing is off, recording costs
+ * a test of esh_trace_enabled.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+extern bool esh_trace_enabled;
+
+/* Start tracing if $ESH_TRACE is set. */
+void esh_trace_init(void);
+
+/* Write out all recorded events and close the trace file. */
+void esh_trace_finish(void);
+
+/* Current time in nanoseconds, for the start of a complete event.
+ * Returns 0 when tracing is off. */
+uint64_t esh_trace_now(void);
+
+/* Record an event named 'name' that started at 'start' (as returned
+ * by esh_trace_now) and ends now.  'tid' is the process it concerns,
+ * or 0 for the shell itself.  'detail', if not NULL, is shown as the
+ * event's argument; it is copied and may be truncated. */
+void esh_trace_complete(const char *name, uint64_t start, pid_t tid,
+                        const char *detail);
+
+/* Like esh_trace_complete, for an event between two CLOCK_MONOTONIC
+ * timestamps taken elsewhere. */
+void esh_trace_span(const char *name, const struct timespec *from,
+                    const struct timespec *to, pid_t tid, const char *detail);
+
+/* Record a point in time. */
+void esh_trace_instant(const char *name, pid_t tid, const char *detail);
+
+/* Name the track of process 'tid', usually after its command. */
+void esh_trace_name_track(pid_t tid, const char *name);
+
+/* Begin and end an event that other events may nest in.  Both must
+ * be called from the same function or its callees, in LIFO order. */
+void esh_trace_begin(const char *name, const char *detail);
+void esh_trace_end(const char *name);
+
+#endif //__ESH_TRACE_H
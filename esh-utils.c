@@ -10,37 +10,104 @@
 #include <dirent.h>
 #include <dlfcn.h>
 #include <limits.h>
+#include <string.h>
 
 #include "esh.h"
+#include "esh-sys-utils.h"
+#include "esh-builtins.h"
 
 /* List of loaded plugins */
 struct list esh_plugin_list;
 
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
 /* Create new command structure and initialize first command word,
  * and/or input or output redirect file. */
 struct esh_command * 
-esh_command_create(char ** argv, 
+esh_command_create(struct esh_command_line *cline,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output)
 {
-    struct esh_command *cmd = malloc(sizeof *cmd);
+    struct esh_command *cmd = obstack_alloc(&cline->arena, sizeof *cmd);
 
-    cmd->iored_input = iored_input;
-    cmd->iored_output = iored_output;
+    cmd->iored_input = NULL;
+    cmd->iored_output = NULL;
     cmd->argv = argv;
-    cmd->append_to_output = append_to_output;
+    cmd->append_to_output = false;
+    list_init(&cmd->redirects);
+    if (iored_input)
+        esh_command_add_redirect(cline, cmd, ESH_REDIRECT_INPUT, 0, -1, iored_input);
+    if (iored_output)
+        esh_command_add_redirect(cline, cmd, append_to_output
+                                 ? ESH_REDIRECT_APPEND : ESH_REDIRECT_OUTPUT,
+                                 1, -1, iored_output);
+    cmd->pid = -1;
+    cmd->relay = false;
+    cmd->branch = 0;
+    cmd->meter = -1;
+    cmd->exec_fd = -1;
+    cmd->execed = cmd->finished = (struct timespec) { 0 };
+    memset(&cmd->rusage, 0, sizeof cmd->rusage);
 
     return cmd;
 }
 
+/* Set cmd's iored_input or iored_output if r is a file redirection
+ * of stdin or stdout. */
+static void
+note_redirect(struct esh_command *cmd, struct esh_redirect *r)
+{
+    if (r->op == ESH_REDIRECT_INPUT && r->fd == 0)
+        cmd->iored_input = r->path;
+    if ((r->op == ESH_REDIRECT_OUTPUT || r->op == ESH_REDIRECT_APPEND)
+            && r->fd == 1) {
+        cmd->iored_output = r->path;
+        cmd->append_to_output = r->op == ESH_REDIRECT_APPEND;
+    }
+}
+
+/* Append a redirection to cmd */
+struct esh_redirect *
+esh_command_add_redirect(struct esh_command_line *cline,
+                         struct esh_command *cmd, enum esh_redirect_op op,
+                         int fd, int srcfd, char *path)
+{
+    struct esh_redirect *r = obstack_alloc(&cline->arena, sizeof *r);
+
+    r->op = op;
+    r->fd = fd;
+    r->srcfd = srcfd;
+    r->path = path;
+    list_push_back(&cmd->redirects, &r->elem);
+    note_redirect(cmd, r);
+    return r;
+}
+
 /* Create a new pipeline containing only one command */
 struct esh_pipeline *
-esh_pipeline_create(struct esh_command *cmd)
+esh_pipeline_create(struct esh_command_line *cline, struct esh_command *cmd)
 {
-    struct esh_pipeline *pipe = malloc(sizeof *pipe);
+    struct esh_pipeline *pipe = obstack_alloc(&cline->arena, sizeof *pipe);
 
     pipe->bg_job = false;
+    pipe->jid = 0;
+    pipe->pgrp = -1;
+    pipe->pipe_size = 0;
+    pipe->alive = 0;
+    pipe->token = -1;
+    pipe->priority = 0;
+    pipe->cgroup = 0;
+    pipe->cgroup_fd = -1;
+    pipe->branches = 0;
+    pipe->meters = NULL;
+    pipe->nmeters = 0;
+    pipe->timed = false;
+    pipe->notify = false;
+    pipe->finished = (struct timespec) { 0 };
+    memset(&pipe->rusage, 0, sizeof pipe->rusage);
     cmd->pipeline = pipe;
     list_init(&pipe->commands);
     list_push_back(&pipe->commands, &cmd->elem);
@@ -70,18 +137,93 @@ esh_command_line_create_empty(void)
 {
     struct esh_command_line *cmdline = malloc(sizeof *cmdline);
 
+    obstack_init(&cmdline->arena);
     list_init(&cmdline->pipes);
     return cmdline;
 }
 
-/* Create a command line with a single pipeline */
-struct esh_command_line *
-esh_command_line_create(struct esh_pipeline *pipe)
+/* Helper for esh_pipeline_copy_out: copy string s to *strings */
+static char *
+copy_string(char **strings, const char *s)
 {
-    struct esh_command_line *cmdline = esh_command_line_create_empty();
+    if (s == NULL)
+        return NULL;
 
-    list_push_back(&cmdline->pipes, &pipe->elem);
-    return cmdline;
+    char *copy = *strings;
+    size_t len = strlen(s) + 1;
+    memcpy(copy, s, len);
+    *strings += len;
+    return copy;
+}
+
+/* Copy a pipeline into a single malloc'd block.  The block holds the
+ * pipeline, followed by its commands, their redirections, their argv
+ * arrays, and finally all strings, so that every part is suitably
+ * aligned. */
+struct esh_pipeline *
+esh_pipeline_copy_out(struct esh_pipeline *pipe)
+{
+    size_t ncmds = 0, nredirects = 0, nargs = 0, strsize = 0;
+    struct list_elem * e;
+
+    for (e = list_begin (&pipe->commands); e != list_end (&pipe->commands);
+         e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        ncmds++;
+        for (char **p = cmd->argv; *p; p++, nargs++)
+            strsize += strlen(*p) + 1;
+        nargs++;
+        for (struct list_elem *r = list_begin(&cmd->redirects);
+             r != list_end(&cmd->redirects); r = list_next(r)) {
+            struct esh_redirect *redirect = list_entry(r, struct esh_redirect, elem);
+            nredirects++;
+            if (redirect->path)
+                strsize += strlen(redirect->path) + 1;
+        }
+    }
+
+    size_t size = sizeof(struct esh_pipeline)
+                + ncmds * sizeof(struct esh_command)
+                + nredirects * sizeof(struct esh_redirect)
+                + nargs * sizeof(char *)
+                + strsize;
+    char *block = malloc(size);
+    if (block == NULL)
+        return NULL;
+
+    struct esh_pipeline *copy = (struct esh_pipeline *) block;
+    struct esh_command *cmds = (struct esh_command *) (copy + 1);
+    struct esh_redirect *redirects = (struct esh_redirect *) (cmds + ncmds);
+    char **args = (char **) (redirects + nredirects);
+    char *strings = (char *) (args + nargs);
+
+    *copy = *pipe;
+    list_init(&copy->commands);
+    for (e = list_begin (&pipe->commands); e != list_end (&pipe->commands);
+         e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        struct esh_command *c = cmds++;
+
+        *c = *cmd;
+        c->argv = args;
+        for (char **p = cmd->argv; *p; p++)
+            *args++ = copy_string(&strings, *p);
+        *args++ = NULL;
+        c->iored_input = c->iored_output = NULL;
+        list_init(&c->redirects);
+        for (struct list_elem *r = list_begin(&cmd->redirects);
+             r != list_end(&cmd->redirects); r = list_next(r)) {
+            struct esh_redirect *redirect = redirects++;
+            *redirect = *list_entry(r, struct esh_redirect, elem);
+            redirect->path = copy_string(&strings, redirect->path);
+            list_push_back(&c->redirects, &redirect->elem);
+            note_redirect(c, redirect);
+        }
+        c->pipeline = copy;
+        list_push_back(&copy->commands, &c->elem);
+    }
+    esh_pipeline_finish(copy);
+    return copy;
 }
 
 /* Print esh_command structure to stdout */
@@ -96,13 +238,33 @@ esh_command_print(struct esh_command *cmd)
 
     printf("\n");
 
-    if (cmd->iored_output)
-        printf("  stdout %ss to %s\n", 
-                cmd->append_to_output ? "append" : "write",
-                cmd->iored_output);
-
-    if (cmd->iored_input)
-        printf("  stdin reads from %s\n", cmd->iored_input);
+    static const char *names[] = { "stdin", "stdout", "stderr" };
+    for (struct list_elem *e = list_begin(&cmd->redirects);
+         e != list_end(&cmd->redirects); e = list_next(e)) {
+        struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+        char fd[16];
+        if (r->fd < 3)
+            snprintf(fd, sizeof fd, "%s", names[r->fd]);
+        else
+            snprintf(fd, sizeof fd, "fd %d", r->fd);
+
+        switch (r->op) {
+        case ESH_REDIRECT_INPUT:
+            printf("  %s reads from %s\n", fd, r->path);
+            break;
+        case ESH_REDIRECT_OUTPUT:
+        case ESH_REDIRECT_APPEND:
+            printf("  %s %ss to %s\n", fd,
+                    r->op == ESH_REDIRECT_APPEND ? "append" : "write", r->path);
+            break;
+        case ESH_REDIRECT_DUP:
+            printf("  %s is a copy of fd %d\n", fd, r->srcfd);
+            break;
+        case ESH_REDIRECT_CLOSE:
+            printf("  %s is closed\n", fd);
+            break;
+        }
+    }
 }
   
 /* Print esh_pipeline structure to stdout */
@@ -145,40 +307,16 @@ esh_command_line_print(struct esh_command_line *cmdline)
 void 
 esh_command_line_free(struct esh_command_line *cmdline)
 {
-    for (struct list_elem * e = list_begin (&cmdline->pipes); e != list_end (&cmdline->pipes); ) {
-        struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
-        e = list_remove(e);
-        esh_pipeline_free(pipe);
-    }
+    obstack_free(&cmdline->arena, NULL);
     free(cmdline);
 }
 
 void 
 esh_pipeline_free(struct esh_pipeline *pipe)
 {
-    for (struct list_elem * e = list_begin (&pipe->commands); e != list_end (&pipe->commands); ) {
-        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
-        e = list_remove(e);
-        esh_command_free(cmd);
-    }
     free(pipe);
 }
 
-void 
-esh_command_free(struct esh_command * cmd)
-{
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
-    }
-    if (cmd->iored_input)
-        free(cmd->iored_input);
-    if (cmd->iored_output)
-        free(cmd->iored_output);
-    free(cmd->argv);
-    free(cmd);
-}
-
 #define PSH_MODULE_NAME "esh_module"
 
 /* Load a plugin referred to by modname */
@@ -239,6 +377,47 @@ esh_plugin_load_from_directory(char *dirname)
     closedir(dir);
 }
 
+struct esh_hooks esh_hooks;
+
+/* Fill esh_hooks.hook with the hook functions of the plugins for
+ * which 'cond' holds, in rank order.  'cond' may refer to 'plugin'. */
+#define BUILD_HOOK_TABLE(hook, cond) do {                               \
+    size_t n = 0;                                                       \
+    struct list_elem * e;                                               \
+    for (e = list_begin(&esh_plugin_list);                              \
+         e != list_end(&esh_plugin_list); e = list_next(e)) {           \
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem); \
+        if (plugin->hook && (cond))                                     \
+            n++;                                                        \
+    }                                                                   \
+    esh_hooks.hook = calloc(n + 1, sizeof *esh_hooks.hook);             \
+    if (esh_hooks.hook == NULL)                                         \
+        esh_sys_fatal_error("calloc: ");                                \
+    n = 0;                                                              \
+    for (e = list_begin(&esh_plugin_list);                              \
+         e != list_end(&esh_plugin_list); e = list_next(e)) {           \
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem); \
+        if (plugin->hook && (cond))                                     \
+            esh_hooks.hook[n++] = plugin->hook;                         \
+    }                                                                   \
+} while (0)
+
+/* Register the built-ins plugins list in their 'builtins' field.
+ * If two plugins provide the same built-in, the lower rank wins. */
+static void
+register_plugin_builtins(void)
+{
+    struct list_elem * e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        if (plugin->process_builtin == NULL)
+            continue;
+        for (const char **b = plugin->builtins; b && *b; b++)
+            if (!esh_builtin_register(*b, plugin->process_builtin))
+                fprintf(stderr, "built-in %s is already defined\n", *b);
+    }
+}
+
 /* Initialize loaded plugins */
 void 
 esh_plugin_initialize(struct esh_shell *shell)
@@ -252,6 +431,67 @@ esh_plugin_initialize(struct esh_shell *shell)
         if (plugin->init)
             plugin->init(shell);
     }
+
+    BUILD_HOOK_TABLE(process_raw_cmdline, true);
+    BUILD_HOOK_TABLE(process_pipeline, true);
+    /* plugins that list their built-ins are found by name instead */
+    BUILD_HOOK_TABLE(process_builtin, plugin->builtins == NULL);
+    BUILD_HOOK_TABLE(make_prompt, true);
+    BUILD_HOOK_TABLE(pipeline_forked, true);
+    BUILD_HOOK_TABLE(command_status_change, true);
+    BUILD_HOOK_TABLE(pipeline_finished, true);
+    register_plugin_builtins();
+}
+
+bool
+esh_plugin_process_raw_cmdline(char **cmdline)
+{
+    for (bool (**h)(char **) = esh_hooks.process_raw_cmdline; *h; h++)
+        if ((*h)(cmdline))
+            return true;
+    return false;
+}
+
+bool
+esh_plugin_process_pipeline(struct esh_pipeline *pipe)
+{
+    for (bool (**h)(struct esh_pipeline *) = esh_hooks.process_pipeline; *h; h++)
+        if ((*h)(pipe))
+            return true;
+    return false;
+}
+
+void
+esh_plugin_pipeline_forked(struct esh_pipeline *pipe)
+{
+    for (void (**h)(struct esh_pipeline *) = esh_hooks.pipeline_forked; *h; h++)
+        (*h)(pipe);
+}
+
+void
+esh_plugin_command_status_change(struct esh_command *cmd, int status)
+{
+    for (bool (**h)(struct esh_command *, int) = esh_hooks.command_status_change;
+         *h; h++)
+        if ((*h)(cmd, status))
+            break;
+}
+
+void
+esh_plugin_pipeline_finished(struct esh_pipeline *pipe)
+{
+    for (void (**h)(struct esh_pipeline *) = esh_hooks.pipeline_finished; *h; h++)
+        (*h)(pipe);
+}
+
+/* Offer cmd to the plugins that did not list their built-ins */
+bool
+esh_plugin_process_builtin(struct esh_command *cmd)
+{
+    for (bool (**h)(struct esh_command *) = esh_hooks.process_builtin; *h; h++)
+        if ((*h)(cmd))
+            return true;
+    return false;
 }
 
 /* TBD: implement unloading. */
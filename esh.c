@@ -5,33 +5,67 @@
  * Virginia Tech.
  */
 #include <stdio.h>
+#include <string.h>
 #include <readline/readline.h>
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
 #include "esh-sys-utils.h"
 #include "esh.h"
+#include "esh-launch.h"
+#include "esh-jobs.h"
+#include "esh-path.h"
+#include "esh-builtins.h"
+#include "esh-trace.h"
+#include "esh-jobserver.h"
+#include "esh-sched.h"
+#include "esh-cgroup.h"
+#include "esh-relay.h"
+#include "esh-redirect.h"
+#include "esh-history.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 //PATH=/opt/rh/devtoolset-7/root/usr/bin:$PATH
 //from the help code list example
 #define iterator(e, list) e = list_begin(list); e != list_end(list); e = list_next(e)
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
 
 //these must be global, since the sigaction can only take certain kinds of params
-//and the update child status must remove jobs from this list
-struct list jobList;
+//the jobs themselves are kept in the job registry (esh-jobs.c)
+//tty stays NULL in batch mode, where the shell does not use the terminal
 struct termios *tty;
-int jobID = 0;
 pid_t shellPID;
+//SIGCHLD stays blocked, the main loop learns about children through this signalfd
+int sigchldFD = -1;
+//epoll set of sigchldFD and of the exec pipes of commands that the shell
+//still waits to exec, which is readable when there is something to handle
+static int childEventsFD = -1;
 
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
+    printf("Usage: %s [-h] [-p plugindir] [-e engine] [-j slots] [-g cgroup] [-c command | script]\n"
         " -h            print this help\n"
-        " -p  plugindir directory from which to load plug-ins\n",
+        " -p  plugindir directory from which to load plug-ins\n"
+        " -e  engine    launch commands with 'spawn' (default), 'fork',\n"
+        "               or 'server' (a fork server started at startup)\n"
+        " -j  slots     run a make jobserver with this many slots, which\n"
+        "               background jobs and makes started from esh share.\n"
+        "               Without -j, esh joins the jobserver in $MAKEFLAGS.\n"
+        " -g  cgroup    start each job in a cgroup of its own below this\n"
+        "               cgroup v2 directory, which must be delegated to you\n"
+        " -c  command   run command in batch mode and exit\n"
+        "     script    run the lines of file script in batch mode and exit\n"
+        "Batch mode is also used when standard input is not a terminal.\n",
         progname);
 
     exit(EXIT_SUCCESS);
@@ -40,22 +74,16 @@ usage(char *progname)
 /* Build a prompt by assembling fragments from loaded plugins that 
  * implement 'make_prompt.'
  *
- * This function demonstrates how to iterate over all loaded plugins.
+ * This function demonstrates how to use the hook dispatch tables.
  */
 static char *build_prompt_from_plugins(void)
 {
     char *prompt = NULL;
-	struct list_elem *e;
-    for (e = list_begin(&esh_plugin_list);
-         e != list_end(&esh_plugin_list); e = list_next(e)) 
+    for (char *(**make_prompt)(void) = esh_hooks.make_prompt;
+         *make_prompt; make_prompt++)
     {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-
-        if (plugin->make_prompt == NULL)
-            continue;
-
         /* append prompt fragment created by plug-in */
-        char * p = plugin->make_prompt();
+        char * p = (*make_prompt)();
         if (prompt == NULL)
         {
             prompt = p;
@@ -80,9 +108,14 @@ static char *build_prompt_from_plugins(void)
  */
 struct esh_shell shell =
 {
+    .get_jobs = esh_jobs_list,
+    .get_job_from_jid = esh_jobs_get_from_jid,
+    .get_job_from_pgrp = esh_jobs_get_from_pgrp,
+    .get_cmd_from_pid = esh_jobs_get_cmd_from_pid,
     .build_prompt = build_prompt_from_plugins,
     .readline = readline,       /* GNU readline(3) */ 
-    .parse_command_line = esh_parse_command_line /* Default parser */
+    .parse_command_line = esh_parse_command_line, /* Default parser */
+    .register_builtin = esh_builtin_register
 };
 
 /*
@@ -97,6 +130,10 @@ struct esh_shell shell =
  */
 static void give_terminal_to(pid_t pgrp, struct termios *pg_tty_state)
 {
+    if (tty == NULL)    /* batch mode */
+        return;
+
+    uint64_t t = esh_trace_now();
     esh_signal_block(SIGTTOU);
     int rc = tcsetpgrp(esh_sys_tty_getfd(), pgrp);
     if (rc == -1)
@@ -104,32 +141,128 @@ static void give_terminal_to(pid_t pgrp, struct termios *pg_tty_state)
     if (pg_tty_state)
         esh_sys_tty_restore(pg_tty_state);
     esh_signal_unblock(SIGTTOU);
+    esh_trace_complete("tty handoff", t, pgrp == shellPID ? 0 : pgrp, NULL);
+}
+//set while readline shows the prompt and waits for input, and once the
+//prompt was erased to make room for a job notification
+static bool atPrompt;
+static bool promptCleared;
+
+/* Called before printing a job notification.  While readline shows the
+ * prompt and the line being edited, the notification would be printed
+ * over them, so they are erased; redraw_prompt() puts them back below
+ * the notification. */
+static void clear_prompt(void)
+{
+	if (!atPrompt || promptCleared)
+		return;
+	rl_clear_visible_line();
+	promptCleared = true;
+}
+
+/* Redraw the prompt and the line being edited if clear_prompt() erased them. */
+static void redraw_prompt(void)
+{
+	if (!promptCleared)
+		return;
+	fflush(stdout);
+	fflush(stderr);
+	rl_forced_update_display();
+	promptCleared = false;
 }
+
+/* How often the shell checks whether queued jobs can be admitted */
+#define QUEUE_POLL_MS 100
+
+static bool have_queued_jobs(void);
+static void start_queued_jobs(void);
+static void release_job(struct esh_pipeline *eshPipe);
+
 /*
- * SIGCHLD handler.
- * Call waitpid() to learn about any child processes that
+ * Reap children after SIGCHLD was reported on sigchldFD.
+ * Call wait4() to learn about any child processes that
  * have exited or changed status (been stopped, needed the
- * terminal, etc.)
+ * terminal, etc.), and about the resources they used.
  * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
+ * data structures.  This runs on the main thread, never
+ * in signal context, so every child that changed state
+ * since the last call is handled in one batch.
  * Use a loop with WNOHANG since only a single SIGCHLD
- * signal may be delivered for multiple children that have
- * exited.
+ * is reported for multiple children that have exited.
  */
-static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
+static void reap_children(void)
 {
+    struct signalfd_siginfo info;
     pid_t child;
     int status;
+    struct rusage rusage;
 
-    assert(sig == SIGCHLD);
-	
-    while ((child = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0)
+    /* drain the signalfd; the wait4 loop below picks up every child */
+    while (read(sigchldFD, &info, sizeof info) == sizeof info)
+        continue;
+
+    uint64_t t = esh_trace_now();
+    while ((child = wait4(-1, &status, WUNTRACED|WNOHANG, &rusage)) > 0)
     {
-        child_status_change(child, status);
+        child_status_change(child, status, &rusage);
+        esh_trace_complete("reap", t, child, NULL);
+        t = esh_trace_now();
     }
+    //jobs that finished may have made room for queued jobs
+    start_queued_jobs();
+}
+
+/* Record that cmd exec'd at 'when' */
+static void record_exec(struct esh_command *cmd, struct timespec *when)
+{
+	cmd->execed = *when;
+	esh_trace_span("exec", &cmd->started, &cmd->execed, cmd->pid, cmd->argv[0]);
+}
+
+/* Wait for cmd's exec pipe, whose read end is fd, to report its exec
+ * through childEventsFD. */
+static void watch_exec(struct esh_command *cmd, int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = cmd };
+	if (epoll_ctl(childEventsFD, EPOLL_CTL_ADD, fd, &ev) == -1)
+		esh_sys_fatal_error("epoll_ctl: ");
+	cmd->exec_fd = fd;
+}
+
+/* Record that cmd, whose exec pipe was watched, exec'd now.  Closing
+ * the pipe also takes it out of childEventsFD. */
+static void exec_done(struct esh_command *cmd)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record_exec(cmd, &now);
+	close(cmd->exec_fd);
+	cmd->exec_fd = -1;
+}
+
+/*
+ * Handle what childEventsFD reports.  Execs are recorded before
+ * children are reaped, so that a command that exec'd and exited in
+ * the meantime gets both.
+ */
+static void handle_child_events(void)
+{
+	struct epoll_event events[16];
+	bool reap = false;
+	int n;
+	do
+	{
+		n = epoll_wait(childEventsFD, events, 16, 0);
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr == NULL)
+				reap = true;
+			else
+				exec_done(events[i].data.ptr);
+		}
+	} while (n == 16);
+	if (reap)
+		reap_children();
 }
 
 /* Wait for all processes in this pipeline to complete, or for
@@ -141,648 +274,1812 @@ static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
  *
  * Implement child_status_change such that it records the
  * information obtained from waitpid() for pid 'child.'
- * If a child has exited or terminated (but not stopped!)
- * it should be removed from the list of commands of its
- * pipeline data structure so that an empty list is obtained
- * if all processes that are part of a pipeline have
- * terminated.  If you use a different approach to keep
- * track of commands, adjust the code accordingly.
+ * Terminated commands stay in their pipeline, so that the
+ * resources they used can be reported; the pipeline's 'alive'
+ * count drops to 0 once all of them have terminated.
  */
 static void wait_for_job(struct esh_pipeline *pipeline)
 {
     assert(esh_signal_is_blocked(SIGCHLD));
 	
-	while (pipeline->status == FOREGROUND && !list_empty(&pipeline->commands)) 
+	esh_trace_begin("wait_for_job", NULL);
+	struct pollfd pfd = { .fd = childEventsFD, .events = POLLIN };
+	while (pipeline->status == FOREGROUND && pipeline->alive > 0) 
 	{
-        int status;
-        pid_t child = waitpid(-1, &status, WUNTRACED);
-		if (child != -1)
-		{
-            child_status_change(child, status);
-		}
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+			esh_sys_fatal_error("poll: ");
+		handle_child_events();
     }
+	esh_trace_end("wait_for_job");
 }
 
-static void printCommand(pid_t pipeJobID)
+//prints a job's new status, such as "Stopped", with its first command
+static void printCommand(struct esh_pipeline *jobPipe, const char *status)
 {
-    struct list_elem *jobElem = list_begin(&jobList);
-    struct esh_pipeline *jobPipe = list_entry(jobElem, struct esh_pipeline, elem);
 	struct esh_command *command = list_entry(list_begin(&jobPipe->commands), struct esh_command, elem);
 	char **argv = command->argv;
 	char* cmd = argv[0];
 	argv++;
 
+	clear_prompt();
 	if (*argv != NULL) 
 	{
-		printf("[%d] Stopped (%s %s)\n", pipeJobID, cmd, *argv);
+		printf("[%d] %s (%s %s)\n", jobPipe->jid, status, cmd, *argv);
 	}
 	else 
 	{
-		printf("[%d] Stopped (%s)\n", pipeJobID, cmd);
+		printf("[%d] %s (%s)\n", jobPipe->jid, status, cmd);
 	}  
 }
 
+/* Add the resources in ru to those in sum */
+static void rusage_add(struct rusage *sum, struct rusage *ru)
+{
+	timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+	timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+	if (ru->ru_maxrss > sum->ru_maxrss)
+		sum->ru_maxrss = ru->ru_maxrss;
+	sum->ru_minflt += ru->ru_minflt;
+	sum->ru_majflt += ru->ru_majflt;
+	sum->ru_inblock += ru->ru_inblock;
+	sum->ru_oublock += ru->ru_oublock;
+	sum->ru_nvcsw += ru->ru_nvcsw;
+	sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+static double seconds_between(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* Print one line of resource usage: wall time, cpu times, max rss,
+ * and voluntary/involuntary context switches.  A command that is
+ * still running has no finish time; its wall time is taken up to now. */
+static void print_usage(FILE *out, struct timespec *started, struct timespec *finished,
+	struct rusage *ru)
+{
+	struct timespec now;
+	if (finished->tv_sec == 0 && finished->tv_nsec == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		finished = &now;
+	}
+	fprintf(out, "%9.3fs real %8.3fs user %8.3fs sys %9ldk rss %7ld/%-7ld csw",
+		seconds_between(started, finished),
+		ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+		ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6,
+		ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/* Print the resource usage of a pipeline and of each of its commands */
+static void print_job_stats(FILE *out, struct esh_pipeline *pipe)
+{
+	struct list_elem *e;
+	if (pipe->status == QUEUED)
+	{
+		fprintf(out, "[%d] queued\n", pipe->jid);
+		return;
+	}
+	fprintf(out, "[%d] ", pipe->jid);
+	print_usage(out, &pipe->started, &pipe->finished, &pipe->rusage);
+	fprintf(out, "  %s\n", pipe->alive > 0 ? "running" : "done");
+	for (iterator(e, &pipe->commands))
+	{
+		struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+		fprintf(out, "    ");
+		print_usage(out, &cmd->started, &cmd->finished, &cmd->rusage);
+		fprintf(out, "  ");
+		for (char **arg = cmd->argv; *arg; arg++)
+			fprintf(out, "%s%s", arg == cmd->argv ? "" : " ", *arg);
+		fprintf(out, "\n");
+	}
+}
+
+static double ms_between(struct timespec *from, struct timespec *to)
+{
+	return seconds_between(from, to) * 1e3;
+}
+
+/* Print what the meters on a job's pipes saw, one line per pipe. */
+static void print_pipestat(FILE *out, struct esh_pipeline *pipe)
+{
+	struct list_elem *e;
+	for (iterator(e, &pipe->commands))
+	{
+		struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+		struct list_elem *next = list_next(e);
+		if (cmd->meter == -1 || next == list_end(&pipe->commands))
+			continue;
+		esh_relay_stats_print(out, cmd->argv[0],
+			list_entry(next, struct esh_command, elem)->argv[0],
+			&pipe->meters[cmd->meter]);
+	}
+}
+
+/* Print what 'time' reports for a finished pipeline: its usage, the
+ * time the shell took to parse the line and to launch the pipeline,
+ * and for each stage the latency from fork to exec, its run time
+ * from exec until it was reaped, and when it was reaped relative to
+ * the start of the pipeline.  All times are in milliseconds. */
+static void print_time_report(FILE *out, struct esh_pipeline *pipe)
+{
+	struct list_elem *e;
+	fprintf(out, "[%d] ", pipe->jid);
+	print_usage(out, &pipe->started, &pipe->finished, &pipe->rusage);
+	fprintf(out, "\n    shell: %.3fms parse, %.3fms launch\n",
+		ms_between(&pipe->parse_started, &pipe->parsed),
+		ms_between(&pipe->started, &pipe->launched));
+	fprintf(out, "    %10s %12s %12s  %s\n", "fork-exec", "exec-reap", "reaped at", "command");
+	for (iterator(e, &pipe->commands))
+	{
+		struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+		fprintf(out, "    %8.3fms %10.3fms %10.3fms ",
+			ms_between(&cmd->started, &cmd->execed),
+			ms_between(&cmd->execed, &cmd->finished),
+			ms_between(&pipe->started, &cmd->finished));
+		for (char **arg = cmd->argv; *arg; arg++)
+			fprintf(out, " %s", *arg);
+		fprintf(out, "\n");
+	}
+}
+
 //this is based on the stopped and terminated jobs from the FAQ
 //http://www.gnu.org/software/libc/manual/html_node/Stopped-and-Terminated-Jobs.html#Stopped-and-Terminated-Jobs
-void child_status_change(pid_t child, int status)
-{
-	struct list_elem *removeElem;
-	struct esh_pipeline *jobPipe;
-	//if the child exited or terminated (not stopped), remove it from the list of commands
-	//use job list because that is the list all of the pipes will be in, since they are
-	//removed and put into it
-	if(child > 0)
-	{
-		//need to remove elemens from pipeline, then if pipeline empty, remove pipeline from the job list
-		//need to go through the job list to then pull the correct pid out of the 
-		//pipeline to kill or stop or whatever
-		//using the example 1 from the help session code to remove
-		struct list_elem *jobElem;
-		//bool needsRemoved = false;
-		for(iterator(jobElem, &jobList))
-		{
-			jobPipe = list_entry(jobElem, struct esh_pipeline, elem);
-			struct list_elem *pipeElem;
-			for(iterator(pipeElem, &jobPipe->commands))
-			{
-				pid_t shellPID = getpgrp();
-				struct esh_command *cmd = list_entry(pipeElem, struct esh_command, elem);
-				//match the pids
-				if(jobPipe->pgrp == child)
-				{
-					//printf("Got in if child");
-					//printf("%d", child);
-               		if (WIFSTOPPED(status))
-		            {
-	                    if (WSTOPSIG(status) == 22) 
-	                    {
-							esh_sys_tty_save(&jobPipe->saved_tty_state);
-	                        jobPipe->status = STOPPED;
-							give_terminal_to(shellPID, tty);
-	                    }
-	                    else
-	                    {
-							esh_sys_tty_save(&jobPipe->saved_tty_state);
-	                        jobPipe->status = STOPPED;
-							printCommand(jobPipe->jid);
-							give_terminal_to(shellPID, tty);
-	                    }
-	                }
-					else if(WIFEXITED(status))
-					{
-						//this is the sigchild we need to handle
-						//set the element to be removed after the loop
-						removeElem = &cmd->elem;
-						list_remove(removeElem);
-						//printf("%s", cmd->argv[0]);
-						//needsRemoved = true;
-						//printf("   exit ");
-						//give_terminal_to(shellPID, tty);
-					}
-					else if(WTERMSIG(status) == 2)
-					{
-						//ctrl-c
-						//according to slides, need to give back control to shell
-						//needsRemoved = true;
-						removeElem = &cmd->elem;
-						list_remove(removeElem);
-						printf("\n");
-						give_terminal_to(shellPID, tty);
-					}
-				}  	
-			}
-			if(list_empty(&jobPipe->commands))
+void child_status_change(pid_t child, int status, struct rusage *rusage)
+{
+	//the job registry maps the pid straight to its command, and the command
+	//knows its pipeline, so there is no need to walk the job list
+	struct esh_command *cmd = esh_jobs_get_cmd_from_pid(child);
+	if (cmd == NULL)
+		return;
+
+	struct esh_pipeline *jobPipe = cmd->pipeline;
+	uint64_t t = esh_trace_now();
+	esh_plugin_command_status_change(cmd, status);
+	esh_trace_complete("hook command_status_change", t, 0, NULL);
+	if (WIFSTOPPED(status))
+	{
+		esh_trace_instant("stop", child, NULL);
+		//every process in the group reports the stop, only handle the first one
+		//a background job never had the terminal, so leave it alone
+		if (jobPipe->status == FOREGROUND && tty != NULL)
+		{
+			esh_sys_tty_save(&jobPipe->saved_tty_state);
+			give_terminal_to(shellPID, tty);
+		}
+		if (jobPipe->status != STOPPED)
+		{
+			jobPipe->status = STOPPED;
+			if (WSTOPSIG(status) != SIGTTOU)
+				printCommand(jobPipe, "Stopped");
+		}
+	}
+	else if (WIFEXITED(status) || WIFSIGNALED(status))
+	{
+		//if the child exited or terminated (not stopped), record what it used;
+		//the command stays in the pipeline so that its usage can be reported
+		esh_jobs_remove_command(cmd);
+		//a command that exits has closed its exec pipe, whether it exec'd or not
+		if (cmd->exec_fd != -1)
+			exec_done(cmd);
+		clock_gettime(CLOCK_MONOTONIC, &cmd->finished);
+		cmd->rusage = *rusage;
+		rusage_add(&jobPipe->rusage, rusage);
+		jobPipe->alive--;
+		esh_trace_span("run", cmd->execed.tv_sec ? &cmd->execed : &cmd->started,
+			&cmd->finished, child, cmd->argv[0]);
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT && jobPipe->status == FOREGROUND)
+		{
+			//ctrl-c
+			//according to slides, need to give back control to shell
+			printf("\n");
+			give_terminal_to(shellPID, tty);
+		}
+		//if all commands terminated, remove pipeline from the job list
+		if (jobPipe->alive == 0)
+		{
+			if (jobPipe->notify && jobPipe->status != FOREGROUND)
+				printCommand(jobPipe, WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "Done");
+			if (jobPipe->meters != NULL || jobPipe->timed)
+				clear_prompt();
+			if (jobPipe->meters != NULL)
 			{
-				list_remove(&jobPipe->elem);
+				fprintf(stderr, "[%d] pipestat\n", jobPipe->jid);
+				print_pipestat(stderr, jobPipe);
 			}
+			release_job(jobPipe);
+			jobPipe->finished = cmd->finished;
+			esh_jobs_remove(jobPipe);
+			if (jobPipe->timed)
+				print_time_report(stderr, jobPipe);
+			t = esh_trace_now();
+			esh_plugin_pipeline_finished(jobPipe);
+			esh_trace_complete("hook pipeline_finished", t, 0, NULL);
 		}
-	}	
+	}
 }
 
-//if someone wants to add new built in commands, they can do so right here and increment the num of built in commands
-const char* builtInCommands[] = {"jobs", "fg", "bg", "kill", "stop"};
-int builtInCmd;
-#define NUM_BUILTIN_CMDS 5
-
 /**
- * This arguement simply takes a string arguement and returns a boolean value of whether or not
- * the commands is a built in command or not.
+ * Helper function that returns the pipeline for the given jobID
  **/
-bool isBuiltIn(char **av)
+struct esh_pipeline* get_job(int jobID) 
+{
+	return esh_jobs_get_from_jid(jobID);
+}
+
+static struct esh_pipeline *start_job(struct esh_pipeline *eshPipe, int token);
+static int signal_job(struct esh_pipeline *eshPipe, int sig);
+static struct esh_pipeline *queue_job(struct esh_pipeline *eshPipe);
+static void release_job_tokens(void);
+static void launch_job(struct esh_pipeline *eshPipe);
+
+/* Largest number of jobs parallel runs at once */
+#define PARALLEL_MAX_JOBS 1024
+
+/* The most recently finished jobs, oldest first, kept for jobstats */
+#define JOB_HISTORY_MAX 10
+static struct list job_history;
+static int job_history_len;
+
+/*
+ * The core built in commands.
+ * They are found through the built in registry (esh-builtins.c), which
+ * looks names up in a perfect hash generated from esh-builtins.gperf.
+ * To add one, list it there and in esh-builtins.h, and define it here.
+ */
+//jobs [-v]
+//lists the jobs.  -v also shows the CPU time and memory used by the cgroup
+//of each job started with -g, which includes all processes the job started,
+//and the throughput of each pipe of a job started with $ESH_PIPESTAT set.
+bool builtin_jobs(struct esh_command *cmd)
+{
+	struct list_elem *jobElem;
+	bool verbose = cmd->argv[1] != NULL && strcmp(cmd->argv[1], "-v") == 0;
+	for(iterator(jobElem, esh_jobs_list())) 
+	{
+		struct esh_pipeline *pipe = list_entry(jobElem, struct esh_pipeline, elem);
+		struct  list_elem *commandElem = list_begin(&pipe->commands);
+		struct esh_command *command = list_entry(commandElem, struct esh_command, elem);
+		char** args = command->argv;
+		//The number returned by the status function returns the status using indexing			
+		char *status[] = {"Running", "Running", "Stopped", "Stopped", "Queued"};
+		printf("[%d] %s (%s", pipe->jid, status[pipe->status], *args);
+		args++;
+		while (*args)
+		{
+			printf(" %s", *args);
+			args++;
+		}
+		if (pipe->bg_job) 
+		{
+			printf(" &");
+		}
+		printf(")\n");		
+		if (verbose)
+		{
+			esh_cgroup_print(stdout, pipe->cgroup, pipe->cgroup_fd);
+			if (pipe->meters != NULL)
+				print_pipestat(stdout, pipe);
+		}
+	}
+	return true;
+}
+
+bool builtin_fg(struct esh_command *cmd)
 {
-	for (int i = 0; i < 5; i++) 
+	char** foregroundArgs = cmd->argv + 1;
+	//If there is a job arg
+	if (*foregroundArgs != NULL) 
 	{
-		if (strncmp(av[0],builtInCommands[i], 5) == 0) 
+		int convertToForeground = atoi(*foregroundArgs);
+		struct esh_pipeline *jobPipe = get_job(convertToForeground);
+		if (jobPipe == NULL)
 		{
-			builtInCmd = i;
+			printf("The jobID: %d doesn't exist\n", convertToForeground);
 			return true;
 		}
+		struct  list_elem *commandElem = list_begin(&jobPipe->commands);
+		struct esh_command *command = list_entry(commandElem, struct esh_command, elem);
+		char** args = command->argv;
+		
+		while (*args) 
+		{
+			printf("%s ", *args);
+			args++;
+		}
+		
+		printf("\n");
+
+		//a queued job starts right away in the foreground, without a jobserver slot
+		if (jobPipe->status == QUEUED)
+		{
+			jobPipe->bg_job = false;
+			launch_job(jobPipe);
+			if (jobPipe->alive == 0)
+				return true;
+		}
+		
+		//Give terminal to job
+		give_terminal_to(jobPipe->pgrp, tty);
+
+		if (jobPipe->status == STOPPED)
+		{						
+			signal_job(jobPipe, SIGCONT);
+			esh_trace_instant("continue", jobPipe->pgrp, NULL);
+		}
+
+		esh_cgroup_set_background(jobPipe->cgroup_fd, false);
+		jobPipe->status = FOREGROUND;
+		//Wait for the child to complete
+		wait_for_job(jobPipe);
+		give_terminal_to(shellPID, tty);
 	}
-	return false;
+	else
+	{
+		printf("Please enter fg command as follows: fg jobID\n");
+	}
+	return true;
 }
 
-/**
- * Helper function that checks the global variable for the job with the
- * given jobID and returns the appropriate pipeline
- **/
-struct esh_pipeline* get_job(int jobID) 
+//bg [-p priority] jobID
+//continues a stopped job in the background.  -p sets the job's priority;
+//a queued job with a higher priority is admitted before the others.
+bool builtin_bg(struct esh_command *cmd)
 {
-	struct list_elem* jobElem = list_begin(&jobList);
-	for (iterator(jobElem, &jobList)) 
+	char** backgroundArgs = cmd->argv + 1;
+	bool setPriority = false;
+	int priority = 0;
+	if (*backgroundArgs != NULL && strcmp(*backgroundArgs, "-p") == 0)
+	{
+		if (backgroundArgs[1] == NULL)
+		{
+			printf("Please enter the bg command as follows: bg [-p priority] jobID\n");
+			return true;
+		}
+		setPriority = true;
+		priority = atoi(backgroundArgs[1]);
+		backgroundArgs += 2;
+	}
+	//If there is a job arg
+	if (*backgroundArgs != NULL) 
 	{
-		struct esh_pipeline *jobPipe = list_entry(jobElem, struct esh_pipeline, elem);
-		if (jobPipe->jid == jobID) 
+		int backgroundJob = atoi(*backgroundArgs);
+		struct esh_pipeline *jobPipe = get_job(backgroundJob);
+		if (jobPipe == NULL)
+		{
+			printf("The jobID: %d doesn't exist\n", backgroundJob);
+			return true;
+		}
+		if (setPriority)
+			jobPipe->priority = priority;
+		if (jobPipe->status == QUEUED)
 		{
-			return jobPipe;
+			if (!setPriority)
+				printf("The jobID: %d is queued\n", backgroundJob);
+			return true;
 		}
+		signal_job(jobPipe, SIGCONT);
+		esh_trace_instant("continue", jobPipe->pgrp, NULL);
+		esh_cgroup_set_background(jobPipe->cgroup_fd, true);
+		jobPipe->status = BACKGROUND;									
+	}
+	else 
+	{
+		printf("Please enter the bg command as follows: bg [-p priority] jobID\n");
 	}
-	return NULL;
+	return true;
 }
 
-/**
- * Helper function that removes a job from the job list
- **/
-static void remove_job(int jobID) 
+bool builtin_kill(struct esh_command *cmd)
 {
-	struct list_elem *removeElem;
-	struct list_elem *jobElem = list_begin(&jobList);
-	for (iterator(jobElem, &jobList)) 
+	//Get the args vector
+	char** killCommand = cmd->argv; 
+	//Increment by one so that the pid now points to the id args
+	killCommand++;
+	if (*killCommand != NULL) 
 	{
-		struct esh_pipeline *jobPipe = list_entry(jobElem, struct esh_pipeline, elem);
-		if (jobPipe->jid == jobID) 
+		//Convert the char pointer to the jobID
+		int jobToKill = atoi(*killCommand);
+		struct esh_pipeline * killPipe = get_job(jobToKill);
+		//a queued job has no processes yet, it is just dropped
+		if (killPipe != NULL && killPipe->status == QUEUED)
+		{
+			esh_jobs_remove(killPipe);
+		}
+		//If the JobID is valid
+		else if (killPipe != NULL) 
+		{
+			//the job is removed once its processes are reaped
+			if (signal_job(killPipe, SIGKILL) < 0) 
+			{
+				printf("Couldn't deliver SIGKILL to jobID : %d \n", jobToKill);
+			}
+		}
+		//If the jobID isnt entered
+		else 
 		{
-			removeElem = jobElem;
+			printf("Please enter a job ID to kill \n");
 		}
 	}
-	list_remove(removeElem);
-}	
+	return true;
+}
 
-int main(int ac, char *av[])
+bool builtin_stop(struct esh_command *cmd)
 {
-	int opt;
-	list_init(&esh_plugin_list);
-	//set up to job list and ID for later use	    
-	list_init(&jobList);
-	esh_signal_sethandler(SIGCHLD, sigchld_handler);
-	//need this to give control of terminal back to shell
-	shellPID = getpid();
-	//printf("%d", shellPID);
-	setpgid(0,0);
-	/* Process command-line arguments. See getopt(3) */
-	while ((opt = getopt(ac, av, "hp:")) > 0)
+	char** stopCommand = cmd->argv;
+	stopCommand++;
+	if (*stopCommand != NULL) 
 	{
-		switch (opt)
+		int jobToStop = atoi(*stopCommand);
+		struct esh_pipeline *jobPipe = get_job(jobToStop);
+		if (jobPipe != NULL && jobPipe->status == QUEUED)
 		{
-		case 'h':
-			usage(av[0]);
-		break;
+			printf("The jobID: %d has not started yet\n", jobToStop);
+		}
+		else if (jobPipe != NULL) 
+		{
+			if(signal_job(jobPipe, SIGSTOP) < 0) 
+			{
+				printf("Couldn't deliver SIGSTOP to jobID; %d \n", jobToStop);
+			}						
+		}
+		else 
+		{
+			printf("The jobID: %d doesn't exitst", jobToStop);
+		}
+	}
+	//If the jobID isnt entered
+	else 
+	{
+		printf("Please enter a job ID to stop");
+	}
+	return true;
+}
 
-		case 'p':
-			esh_plugin_load_from_directory(optarg);
-            	break;
-        	}
-    	}	
-	
-	esh_plugin_initialize(&shell);
-	//need to initialize the terminal state
-	tty = esh_sys_tty_init();
-	/* Read/eval loop. */
-	for (;;)
+//hash           list the resolved-command cache and its counters
+//hash -r        forget all cached commands
+//hash -d name   forget one command
+//hash name...   look up commands and add them to the cache
+bool builtin_hash(struct esh_command *cmd)
+{
+	char** hashArgs = cmd->argv + 1;
+	if (*hashArgs == NULL)
 	{
-        	/* Do not output a prompt unless shell's stdin is a terminal */
-        	char * prompt = isatty(0) ? shell.build_prompt() : NULL;
-        	char * cmdline = shell.readline(prompt);
-        	free (prompt);
+		esh_path_print();
+	}
+	else if (strcmp(*hashArgs, "-r") == 0)
+	{
+		esh_path_forget_all();
+	}
+	else if (strcmp(*hashArgs, "-d") == 0)
+	{
+		for (hashArgs++; *hashArgs != NULL; hashArgs++)
+			if (!esh_path_forget(*hashArgs))
+				printf("hash: %s: not found\n", *hashArgs);
+	}
+	else
+	{
+		for (; *hashArgs != NULL; hashArgs++)
+			if (esh_path_lookup(*hashArgs) == NULL)
+				printf("hash: %s: not found\n", *hashArgs);
+	}
+	return true;
+}
 
-        	if (cmdline == NULL)  /* User typed EOF */
-            		break;
+//jobstats       show the resources used by current and recently finished jobs
+bool builtin_jobstats(struct esh_command *cmd)
+{
+	struct list_elem *e;
+	for (iterator(e, &job_history))
+		print_job_stats(stdout, list_entry(e, struct esh_pipeline, elem));
+	for (iterator(e, esh_jobs_list()))
+		print_job_stats(stdout, list_entry(e, struct esh_pipeline, elem));
+	return true;
+}
 
-        	struct esh_command_line * cline = shell.parse_command_line(cmdline);
-        	free (cmdline);
-        	if (cline == NULL)                  /* Error in command line */
-            		continue;
+static int count_running_jobs(void);
 
-        	if (list_empty(&cline->pipes))   /*User hit enter*/
-        	{
-            		esh_command_line_free(cline);
-            		continue;
-        	}
-        	//our code
-        	execCmd(cline, shellPID); 		
+//sched                 show the limits for admitting background jobs
+//sched limit value     set one: jobs, load, cpu, memory (pressure, in %),
+//                      or available (memory, with k, M or G); 0 turns it off
+bool builtin_sched(struct esh_command *cmd)
+{
+	char **schedArgs = cmd->argv + 1;
+	if (*schedArgs == NULL)
+	{
+		esh_sched_print(count_running_jobs());
+		return true;
 	}
-	return 0;
+	if (schedArgs[1] == NULL || schedArgs[2] != NULL
+		|| !esh_sched_set(schedArgs[0], schedArgs[1]))
+	{
+		printf("Please enter the sched command as follows: sched [limit value]\n");
+		return true;
+	}
+	//a raised limit may admit queued jobs right away
+	start_queued_jobs();
+	return true;
 }
 
-enum {READ = 0, WRITE = 1};
-
-/**
- * https://www.gnu.org/software/libc/manual/html_node/Descriptor-Flags.html
- * This function basically sets the close on exec function
- **/
-static int set_cloexec_flag (int desc, int value)
+//cgroup                show the limits of the cgroups jobs are started in
+//cgroup limit value    set one for jobs started from now on: cpu or io (the
+//                      weight of background jobs, 1-10000; foreground jobs
+//                      get 100), or memory (with k, M or G; 0 for no limit)
+bool builtin_cgroup(struct esh_command *cmd)
 {
-  int oldflags = fcntl (desc, F_GETFD, 0);
-  /* If reading the flags failed, return error indication now. */
-  if (oldflags < 0)
-    return oldflags;
-  /* Set just the flag we want to set. */
-  if (value != 0)
-    oldflags |= FD_CLOEXEC;
-  else
-    oldflags &= ~FD_CLOEXEC;
-  /* Store modified flag word in the descriptor. */
-  return fcntl (desc, F_SETFD, oldflags);
+	char **cgroupArgs = cmd->argv + 1;
+	if (*cgroupArgs == NULL)
+	{
+		esh_cgroup_print_limits();
+		return true;
+	}
+	if (cgroupArgs[1] == NULL || cgroupArgs[2] != NULL
+		|| !esh_cgroup_set(cgroupArgs[0], cgroupArgs[1]))
+	{
+		printf("Please enter the cgroup command as follows: cgroup [limit value]\n");
+	}
+	return true;
 }
 
+/* Return word with each {} in it replaced by line, allocated in arena.
+ * Sets *substituted if there was a {} to replace. */
+static char *substitute(struct obstack *arena, const char *word, const char *line,
+	bool *substituted)
+{
+	const char *brace;
+	while ((brace = strstr(word, "{}")) != NULL)
+	{
+		obstack_grow(arena, word, brace - word);
+		obstack_grow(arena, line, strlen(line));
+		word = brace + 2;
+		*substituted = true;
+	}
+	obstack_grow0(arena, word, strlen(word));
+	return obstack_finish(arena);
+}
 
-void execCmd(struct esh_command_line *cline, pid_t shellPID)
+/* Start the command template for one input line of parallel, as a
+ * background job that reads from /dev/null.  The job gets the
+ * redirections of parallel's command cmd, but for its input redirection
+ * if that is what parallel reads, and appends where cmd's '>' would
+ * truncate.  Like a job run with &, it is queued until the scheduler
+ * admits it and it gets a jobserver slot.  Returns the job. */
+static struct esh_pipeline *start_parallel_job(char **template, char *line,
+	struct esh_command *cmd, bool readsInput)
 {
-/****If looping thru commands in different, dont use same list elem, make new one. warns in slides to do so ****/
-	/*need to split cline into its components to get argv later
-	 *need to check plugins 
-     *handle built in commands
-     *separate pipe from cline to add jobs to list (like in slides)
-     *save the shell state
-	 *create the pipes
-	 *block sigchild while running the child process
-	 *check bg job, else give terminal access
-	 *check io redirect
-	 *execute the command with error checking
-	 *handle parent stuff
-	 *make sure both ends of pipe are closed if not at begin
-	 *set next pipes if not at end of list
-	 *if at end of list close all pipes
-	 *if it is a backgroind job, set current as bg
-	 *if not, need to wait for job
-	 *unblock sigchild
-	 */
-	
-	//retrieving data out of cline
-	struct esh_pipeline *eshPipe = list_entry(list_begin(&cline->pipes), struct esh_pipeline, elem);
-	struct esh_command *cmds = list_entry(list_begin(&eshPipe->commands), struct esh_command, elem);
-	char** argVector = cmds->argv;
+	struct esh_command_line *cline = esh_command_line_create_empty();
+	int nwords = 0;
+	while (template[nwords] != NULL)
+		nwords++;
 
-	pid_t child;
-	bool isBG;
-	//first element of argv will be a built in command
-	if(!isBuiltIn(cmds->argv))
-	{
-		//adding jobs to the list
-		struct list_elem *eshElem; 
-		eshElem = list_pop_front(&cline->pipes);
-		list_push_back(&jobList, eshElem);
-	
-		//Save the current terminal state if we need to suspend a job
-		esh_sys_tty_save(&eshPipe->saved_tty_state);
-		//increment the job id as needed
-		jobID = jobID+1;
-		//if the list is empty, we know the only job is the one we are currently in
-		if(list_empty(&jobList))
-		{
-			jobID = 1;
-		}
+	char **argv = obstack_alloc(&cline->arena, (nwords + 2) * sizeof *argv);
+	bool substituted = false;
+	for (int i = 0; i < nwords; i++)
+		argv[i] = substitute(&cline->arena, template[i], line, &substituted);
+	//without a {}, the line becomes the last argument
+	argv[nwords] = substituted ? NULL : line;
+	argv[nwords + 1] = NULL;
 
-		// if (strcmp(cmds->argv[0], "nano") || strcmp(cmds->argv[0], "vim") == 0) {
-		// 	jobID = 1;
-		// }
+	struct esh_command *job = esh_command_create(cline, argv, "/dev/null", NULL, false);
+	struct list_elem *e;
+	for (iterator(e, &cmd->redirects))
+	{
+		struct esh_redirect *r = list_entry(e, struct esh_redirect, elem);
+		if (readsInput && r->op == ESH_REDIRECT_INPUT && r->fd == 0)
+			continue;
+		esh_command_add_redirect(cline, job,
+			r->op == ESH_REDIRECT_OUTPUT ? ESH_REDIRECT_APPEND : r->op,
+			r->fd, r->srcfd, r->path);
+	}
+	struct esh_pipeline *pipe = esh_pipeline_create(cline, job);
+	pipe->bg_job = true;
+	clock_gettime(CLOCK_MONOTONIC, &pipe->started);
+	pipe = queue_job(pipe);
+	esh_command_line_free(cline);
+	start_queued_jobs();
+	return pipe;
+}
 
-		//now the pipeline needs its job id set and process group id set for later
-		eshPipe->jid = jobID;
-		eshPipe->pgrp = -1;
-		//Get the esh_pipeline struct type
-		//Set process pipeline to true if the list size is greater than 1. i.e. has more than 1 command
-		
-		bool isPipeLine = (list_size(&eshPipe->commands) > 1);
-		int pipeA[2];
-		int pipeB[2];
-		//loop through the list of commands and exec on them
-		//Get the first pipe element
-		struct list_elem *pipeElem;
-		for(iterator(pipeElem, &eshPipe->commands))
-		{
-			struct esh_command *currCommand = list_entry(pipeElem, struct esh_command, elem);
-			//When handling piping there are 3 major cases:
-			//the commands within the pipe are either at: the beginnig, the middle or the end
-			//Handling pipeline commands. If a command is a pipeline command, we need to create
-			//additional pipes if the command being processed is not the last one.
-			//Pipes for handling additional commands			
- 			if (isPipeLine)
-			{
-				if((pipeElem == list_begin(&eshPipe->commands)))
-				{
-					//Create two pipes
-					pipe(pipeA);
-					pipe(pipeB);
-					set_cloexec_flag(pipeA[0], 1);
-					set_cloexec_flag(pipeB[0], 1);
-					set_cloexec_flag(pipeA[1], 1);
-					set_cloexec_flag(pipeB[1], 1);						
-				}
-			}
+/* Return true while a job of parallel is queued or running. */
+static bool parallel_job_pending(struct esh_pipeline *job)
+{
+	//a job none of whose commands could be started is no longer registered
+	if (job->status == QUEUED)
+		return esh_jobs_get_from_jid(job->jid) == job;
+	return job->alive > 0;
+}
 
-			//book, pg 779 has logic for blocking and unblocking
-			//have parent block before child, so that add and delete run correctly
-			esh_signal_block(SIGCHLD);
+/* Wait for at least one of the n jobs in running to finish.  Returns
+ * the number of jobs still pending, which are moved to the front. */
+static int wait_for_parallel_job(struct esh_pipeline **running, int n)
+{
+	struct pollfd pfd = { .fd = childEventsFD, .events = POLLIN };
+	for (;;)
+	{
+		int left = 0;
+		for (int i = 0; i < n; i++)
+			if (parallel_job_pending(running[i]))
+				running[left++] = running[i];
+		if (left < n)
+			return left;
 
-			isBG = eshPipe->bg_job;
-			//this is based on the documentation from the FAQ
-			//http://www.gnu.org/software/libc/manual/html_node/Launching-Jobs.html#Launching-Jobs
-			//we are in child process if fork was returned 0
-			if((child = fork()) == 0)
-			{
-				esh_signal_unblock(SIGCHLD);
-				//this is to put the process into the process group
-				//and give it the apropriate terminal access
-				child = getpid();
-				currCommand->pid = child;
-				if(eshPipe->pgrp == -1)
-					eshPipe->pgrp = child;
-				if(setpgid(child, eshPipe->pgrp))
-					esh_sys_fatal_error("Error setpgid child:\n");
-				
-				//If we are in a child process, we need to check the pipe to see which command we are at
-				//so that
-				if (isPipeLine)
-				{
-					
-					//Since the beginning is already handled, we need to change file descriptors to
-					//set up pipes for processes in the middle
-					if (pipeElem != list_begin(&eshPipe->commands)) 
-					{
-						close(pipeA[1]);
-						dup2(pipeA[0], 0);
-						close(pipeA[0]);
-					}
-					//If the current commands is not the last command set up the pipes
-					if (pipeElem != list_rbegin(&eshPipe->commands)) 
-					{
-						close(pipeB[0]);
-						dup2(pipeB[1], 1);
-						close(pipeB[1]);
-					}
-									
-				}
-				//check for IO redirect
-                if (currCommand->iored_input != NULL)
-                {
-					//Create a input file descriptor to read the input
-                	int inputFD = open(currCommand->iored_input, O_RDONLY);
-                	if (dup2(inputFD, 0) < 0)
-                	{
-                			esh_sys_fatal_error("Error dup2\n");
-                	}
-                	close(inputFD);
-					currCommand->iored_input = 0;
-                }
-                else if (currCommand->iored_output != NULL)
-                {
-                	//Create a output file descriptor for output
-                   	int outFD;
-                   	if (currCommand->append_to_output)
-                   	{
-						//this is if the file exits
-                    	outFD = open(currCommand->iored_output, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
-                   	}	
-                   	else
-                   	{
-						//if the file doesnt exist create it
-                    	outFD = open(currCommand->iored_output, O_WRONLY | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
-					}
-                   	if (dup2(outFD, 1) < 0)
-                   	{
-                       	esh_sys_fatal_error("Error dup2\n");
-                   	}
-                	//close the file descriptor
-                   	close(outFD);				
-                }
-
-
-				if(!isBG)
-				{
-					give_terminal_to(eshPipe->pgrp, tty);
-					eshPipe->status = FOREGROUND;
-					//fprintf(stderr, "CHILD %s: i'm process %d, my eshPGRP is %d, my group is %d, and group %d owns my terminal\n",
-         				//currCommand->argv[0], getpid(), eshPipe->pgrp, getpgrp(), tcgetpgrp(open("/dev/tty", O_RDONLY)));
-				}
-				else
-				{
-					eshPipe->status = BACKGROUND;
-				}
-
-				if(execvp(currCommand->argv[0], currCommand->argv) < 0)
-				{
-					esh_sys_fatal_error("Could not find command");
-				}
-			}
-			else if(child < 0)
+		//the load may drop, or a make that shares the jobserver may free a slot,
+		//without the shell hearing about it, so it checks now and then
+		int ready = poll(&pfd, 1, have_queued_jobs() ? QUEUE_POLL_MS : -1);
+		if (ready == -1 && errno != EINTR)
+			esh_sys_fatal_error("poll: ");
+		if (ready == 0)
+			start_queued_jobs();
+		handle_child_events();
+	}
+}
+
+//parallel [-j N] [-a file] command [arg...]
+//runs command once for each line of input, with each {} in its arguments
+//replaced by the line, or with the line as an extra argument if there is no {}.
+//Lines are read from file, from the < redirection, or from standard input.
+//Every command is a background job; at most N of them run at once, and the
+//next one starts as soon as one finishes.  N defaults to the number of CPUs.
+//Like jobs run with &, they also wait for the scheduler to admit them and
+//for a jobserver slot, so fewer may run at once.
+//Every command gets parallel's other redirections.  A file that > names is
+//truncated once, before the first command, and they all append to it, so
+//the output of commands that run at the same time may interleave.
+bool builtin_parallel(struct esh_command *cmd)
+{
+	char **parallelArgs = cmd->argv + 1;
+	long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *input = cmd->iored_input;
+
+	for (; *parallelArgs != NULL && (*parallelArgs)[0] == '-'; parallelArgs++)
+	{
+		if (strncmp(*parallelArgs, "-j", 2) == 0)
+		{
+			const char *n = (*parallelArgs)[2] ? *parallelArgs + 2 : *++parallelArgs;
+			maxJobs = n ? atol(n) : 0;
+			if (n == NULL)
+				break;
+		}
+		else if (strcmp(*parallelArgs, "-a") == 0 && parallelArgs[1] != NULL)
+			input = *++parallelArgs;
+		else
+			break;
+	}
+	if (*parallelArgs == NULL || (*parallelArgs)[0] == '-' || maxJobs < 1)
+	{
+		printf("Please enter parallel as follows: parallel [-j N] [-a file] command [arg...]\n");
+		return true;
+	}
+	if (maxJobs > PARALLEL_MAX_JOBS)
+		maxJobs = PARALLEL_MAX_JOBS;
+
+	FILE *in = input ? fopen(input, "re") : stdin;
+	if (in == NULL)
+	{
+		esh_sys_error("parallel: %s: ", input);
+		return true;
+	}
+	if (!esh_redirect_truncate(cmd))
+	{
+		if (in != stdin)
+			fclose(in);
+		return true;
+	}
+
+	//the jobs' output must not overtake what the shell printed so far
+	fflush(stdout);
+	struct esh_pipeline *running[maxJobs];
+	int nrunning = 0;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, in)) != -1)
+	{
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+
+		if (nrunning == maxJobs)
+			nrunning = wait_for_parallel_job(running, nrunning);
+		running[nrunning++] = start_parallel_job(parallelArgs, line, cmd,
+			input == cmd->iored_input);
+	}
+	while (nrunning > 0)
+		nrunning = wait_for_parallel_job(running, nrunning);
+
+	free(line);
+	if (in != stdin)
+		fclose(in);
+	else
+		clearerr(stdin);
+	return true;
+}
+
+/* Release the jobs that have finished since the last call.
+ * Jobs are not freed when their last process is reaped, since
+ * wait_for_job may still be looking at them.  The last few are
+ * kept in the history jobstats reports from. */
+static void free_finished_jobs(void)
+{
+	struct esh_pipeline *job;
+	while ((job = esh_jobs_pop_finished()) != NULL)
+	{
+		//a job that never started a command has nothing to report
+		if (job->alive != 0 || job->pgrp == -1)
+		{
+			esh_pipeline_free(job);
+			continue;
+		}
+		list_push_back(&job_history, &job->elem);
+		if (++job_history_len > JOB_HISTORY_MAX)
+		{
+			esh_pipeline_free(list_entry(list_pop_front(&job_history),
+				struct esh_pipeline, elem));
+			job_history_len--;
+		}
+	}
+}
+
+/* Parse and execute the input line *cmdline, a string from malloc().
+ * A plugin may replace it, so the caller frees *cmdline afterwards,
+ * not the line it passed. */
+static void run_command_line(char **line)
+{
+	//plugins may rewrite the line or consume it entirely
+	uint64_t t = esh_trace_now();
+	bool consumed = esh_plugin_process_raw_cmdline(line);
+	esh_trace_complete("hook process_raw_cmdline", t, 0, NULL);
+	if (consumed)
+		return;
+
+	char *cmdline = *line;
+	struct timespec parse_started;
+	clock_gettime(CLOCK_MONOTONIC, &parse_started);
+	t = esh_trace_now();
+	struct esh_command_line * cline = shell.parse_command_line(cmdline);
+	esh_trace_complete("parse", t, 0, cmdline);
+	if (cline == NULL)                  /* Error in command line */
+		return;
+	cline->parse_started = parse_started;
+
+	if (list_empty(&cline->pipes))   /*User hit enter*/
+	{
+		esh_command_line_free(cline);
+		return;
+	}
+	//our code
+	execCmd(cline, shellPID);
+	free_finished_jobs();
+}
+
+static bool sawEOF;
+//when readline started waiting for the current line, for the trace
+static uint64_t readlineStarted;
+
+static void install_line_handler(void);
+
+/* readline callback, called with a complete input line or NULL on EOF */
+static void handle_line(char *cmdline)
+{
+	//take readline off the terminal while the command runs
+	rl_callback_handler_remove();
+	atPrompt = false;
+	esh_trace_complete("readline", readlineStarted, 0, cmdline);
+	if (cmdline == NULL)  /* User typed EOF */
+	{
+		sawEOF = true;
+		return;
+	}
+	esh_history_add(cmdline);
+	run_command_line(&cmdline);
+	free(cmdline);
+	install_line_handler();
+}
+
+static void install_line_handler(void)
+{
+	/* Do not output a prompt unless shell's stdin is a terminal */
+	uint64_t t = esh_trace_now();
+	char * prompt = isatty(0) ? shell.build_prompt() : NULL;
+	esh_trace_complete("hook make_prompt", t, 0, NULL);
+	rl_callback_handler_install(prompt, handle_line);
+	free(prompt);
+	atPrompt = true;
+	readlineStarted = esh_trace_now();
+}
+
+/*
+ * Event loop.
+ * Input and SIGCHLD are both multiplexed through epoll, so readline
+ * is driven through its callback interface and children are reaped
+ * on the main thread as soon as they change state, even while the
+ * user is typing.
+ */
+static void event_loop(void)
+{
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1)
+		esh_sys_fatal_error("epoll_create1: ");
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = 0 };
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev) == -1)
+		esh_sys_fatal_error("epoll_ctl: ");
+	ev.data.fd = childEventsFD;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, childEventsFD, &ev) == -1)
+		esh_sys_fatal_error("epoll_ctl: ");
+
+	//keep readline's signal handlers around between characters so that
+	//the terminal is cleaned up if a signal arrives while we wait
+	rl_persistent_signal_handlers = 1;
+	install_line_handler();
+	while (!sawEOF)
+	{
+		struct epoll_event events[2];
+		//the load may drop, or a make that shares the jobserver may free a slot,
+		//without the shell hearing about it, so it checks now and then
+		int n = epoll_wait(epfd, events, 2, have_queued_jobs() ? QUEUE_POLL_MS : -1);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			esh_sys_fatal_error("epoll_wait: ");
+		}
+		if (n == 0)
+		{
+			start_queued_jobs();
+			redraw_prompt();
+		}
+		for (int i = 0; i < n && !sawEOF; i++)
+		{
+			if (events[i].data.fd == childEventsFD)
 			{
-				esh_sys_fatal_error("Fork failed");	
+				handle_child_events();
+				free_finished_jobs();
+				redraw_prompt();
 			}
 			else
-			{
-				//we are in parent process
-				//update the child pgrp
-				currCommand->pid = child;				
-				if(eshPipe->pgrp == -1)
-					eshPipe->pgrp = child;				
-				if(setpgid(child, eshPipe->pgrp))
-					esh_sys_fatal_error("Error setpgid parent:\n");				
-				eshPipe->status = FOREGROUND;
-				//fprintf(stderr, "Parent %s: i'm process %d, my eshPGRP is %d, my group is %d, and group %d owns my terminal\n",
-         			//currCommand->argv[0], getpid(), eshPipe->pgrp, getpgrp(), tcgetpgrp(open("/dev/tty", O_RDONLY)));
-				//We now have to set up the pipes in the parents end
- 				if (isPipeLine) 
-				{
-					//Once we reach the final command all the pipes need to be closed
-					if(pipeElem == list_rbegin(&eshPipe->commands))
-					{
-						close(pipeB[0]);
-						close(pipeB[1]);
-						close(pipeA[0]);
-						close(pipeA[1]);
-					}
-					//We need to close the pipes to the beginning of the commands till we receive a response from other
-					//commands in the pipeline
-					if (pipeElem != list_begin(&eshPipe->commands)) 
-					{
-						close(pipeA[0]);
-						close(pipeA[1]);
-					}
-					//If we are not at the end or the beginning and at the middle of the command we need to set up the pipes
-					//to connect the commands
-					if (pipeElem != list_rbegin(&eshPipe->commands)) 
-					{
-						pipeA[0] = pipeB[0];
-						pipeA[1] = pipeB[1];
-					}					
-				}
-			}
-			
-			if((eshPipe->bg_job) == true)
-			{
-				eshPipe->status = BACKGROUND;
-				printf("[%d] %d\n", eshPipe->jid, eshPipe->pgrp);
-			}
-			//now that we are out of the parent process, before we go back to the shell, we need to
+				rl_callback_read_char();
+		}
+	}
+	close(epfd);
+}
+
+/*
+ * Batch mode.
+ * Scripts are read in large blocks, or mapped if they are regular
+ * files, and split into lines in place.  There is no readline, no
+ * prompt, and the terminal is never handed to a job.
+ */
+struct script {
+	char *buf;	//script text, mapped or malloc'd
+	size_t len;	//bytes of text in buf
+	size_t size;	//capacity of buf if malloc'd, 0 if mapped
+	size_t pos;	//offset of the next line
+	int fd;		//file still being read, -1 once all text is in buf
+	size_t chunk;	//most bytes to read from fd at once
+	int seek_fd;	//mapped standard input, whose offset follows pos, or -1
+	char *tail;	//copy of a last line that has no newline
+};
+
+#define SCRIPT_BLOCK (64 * 1024)
+
+/* Set up s to run the text of string text. */
+static void script_open_string(struct script *s, const char *text)
+{
+	s->buf = strdup(text);
+	s->len = s->size = strlen(text) + 1;
+	s->pos = 0;
+	s->fd = -1;
+	s->seek_fd = -1;
+	s->tail = NULL;
+}
+
+/* Set up s to run the lines of fd.  Regular files are mapped,
+ * anything else is read as it is needed. */
+static void script_open_fd(struct script *s, int fd)
+{
+	struct stat st;
+	s->pos = 0;
+	s->seek_fd = -1;
+	s->tail = NULL;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		//a private writable mapping, so lines can be terminated in place
+		s->buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (s->buf != MAP_FAILED)
+		{
+			madvise(s->buf, st.st_size, MADV_SEQUENTIAL);
+			s->len = st.st_size;
+			s->size = 0;
+			s->fd = -1;
+			return;
 		}
-		//1. wait for the job to terminate, if in the foreground
-		if((eshPipe->bg_job) == false)
-			wait_for_job(eshPipe);
-		//2. give the terminal back to the shell
-		give_terminal_to(shellPID, tty);
-		//3. unblock sig child
-		esh_signal_unblock(SIGCHLD);
 	}
-	//If it is a built in command
+
+	s->buf = malloc(SCRIPT_BLOCK);
+	if (s->buf == NULL)
+		esh_sys_fatal_error("malloc: ");
+	s->len = 0;
+	s->size = SCRIPT_BLOCK;
+	s->chunk = SCRIPT_BLOCK;
+	s->fd = fd;
+}
+
+/* Set up s to run the lines of standard input, which the commands of
+ * the script share: as with POSIX sh, a command that reads it must find
+ * what follows its own line, and the script goes on after what the
+ * command read.  A mapped file has its offset moved to each line's end
+ * before the line runs; anything else is read a byte at a time, so the
+ * shell never reads ahead. */
+static void script_open_stdin(struct script *s)
+{
+	off_t at = lseek(0, 0, SEEK_CUR);
+	script_open_fd(s, 0);
+	if (s->size == 0 && at != -1)
+	{
+		s->seek_fd = 0;
+		s->pos = at < (off_t) s->len ? (size_t) at : s->len;
+	}
 	else
+		s->chunk = 1;
+}
+
+/* Return the next line of the script without its newline, or NULL
+ * at the end.  The line is valid until the next call. */
+static char *script_next_line(struct script *s)
+{
+	for (;;)
 	{
-		//The built in command variable is set by the isBuiltIn() function
-		switch (builtInCmd)
-		{
-			case 0 : ;//jobs				
-				if (list_size(&jobList) > 0) 
-				{
-					struct list_elem *jobElem = list_begin(&jobList);
-					for(iterator(jobElem, &jobList)) 
-					{
-						struct esh_pipeline *pipe = list_entry(jobElem, struct esh_pipeline, elem);
-						struct  list_elem *commandElem = list_begin(&pipe->commands);
-						struct esh_command *command = list_entry(commandElem, struct esh_command, elem);
-						char** args = command->argv;
-						//The number returned by the status function returns the status using indexing			
-						char *status[] = {"Running", "Running", "Stopped", "Stopped"};
-						printf("[%d] %s (%s", pipe->jid, status[pipe->status], *args);
-						args++;
-						while (*args)
-						{
-							printf(" %s", *args);
-							args++;
-						}
-						if (pipe->bg_job) 
-						{
-							printf(" &");
-						}
-						printf(")\n");		
-				};
-			break;					
-
-			case 1 : ; //fg
-				esh_signal_block(SIGCHLD);
-				char** foregroundArgs = argVector;				
-				foregroundArgs++;
-				//If there is a job arg
-				if (foregroundArgs != NULL) 
-				{
-					int convertToForeground = atoi(*foregroundArgs);
-					struct esh_pipeline *jobPipe = get_job(convertToForeground);
-					struct  list_elem *commandElem = list_begin(&jobPipe->commands);
-					struct esh_command *command = list_entry(commandElem, struct esh_command, elem);
-					char** args = command->argv;
-					
-					while (*args) 
-					{
-						printf("%s ", *args);
-						args++;
-					}
-					
-					printf("\n");
-					
-					//Give terminal to job
-					give_terminal_to(jobPipe->pgrp, tty);
-
-					if (jobPipe->status == STOPPED)
-					{						
-						kill(jobPipe->pgrp, SIGCONT);
-					}
-
-					jobPipe->status = FOREGROUND;
-					//Wait for the child to complete
-					wait_for_job(jobPipe);
-					esh_signal_unblock(SIGCHLD);
-				}
-				else
-				{
-					printf("Please enter fg command as follows: fg jobID");
-				}
-				break;
-				
-			case 2 : ;//bg
-				char** backgroundArgs = argVector;
-				backgroundArgs++;
-				//If there is a job arg
-				if (backgroundArgs != NULL) 
-				{
-					int backgroundJob = atoi(*backgroundArgs);
-					struct esh_pipeline *jobPipe = get_job(backgroundJob);
-					kill(jobPipe->pgrp, SIGCONT);
-					jobPipe->status = BACKGROUND;									
-				}
-				else 
-				{
-					printf("Please enter the bg command as follows: bg jobID");
-				}
-				break;
+		char *start = s->buf + s->pos;
+		char *nl = memchr(start, '\n', s->len - s->pos);
+		if (nl != NULL)
+		{
+			*nl = '\0';
+			s->pos = nl + 1 - s->buf;
+			if (s->seek_fd != -1)
+				lseek(s->seek_fd, s->pos, SEEK_SET);
+			return start;
+		}
 
-			case 3 : ;//kill;
-				//Get the args vector
-				char** killCommand = argVector; 
-				//Increment by one so that the pid now points to the id args
-				killCommand++;
-				if (*killCommand != NULL) 
-				{
-					//Convert the char pointer to the jobID
-					int jobToKill = atoi(*killCommand);
-					struct esh_pipeline * killPipe = get_job(jobToKill);
-					//If the JobID is valid
-					if (killPipe != NULL) 
-					{
-						int killPid = killPipe->pgrp;
-						if (kill(killPid, SIGKILL) < 0) 
-						{
-							printf("Couldn't deliver SIGKILL to jobID : %d \n", jobToKill);
-						}
-						else 
-						{
-							jobID = jobID - 1;
-							remove_job(jobToKill);
-						}		
-					}
-					//If the jobID isnt entered
-					else 
-					{
-						printf("Please enter a job ID to kill \n");
-					}
-
-				};
-				break;
-			case 4 : ;//stop
-				char** stopCommand = argVector;
-				stopCommand++;
-				if (*stopCommand != NULL) 
-				{
-					int jobToStop = atoi(*stopCommand);
-					struct esh_pipeline *jobPipe = get_job(jobToStop);
-					if (jobPipe != NULL) 
-					{
-						int jobPid = jobPipe->pgrp;
-						if(kill(jobPid, SIGSTOP) < 0) 
-						{
-							printf("Couldn't deliver SIGSTOP to jobID; %d \n", jobToStop);
-						}						
-					}
-					else 
-					{
-						printf("The jobID: %d doesn't exitst", jobToStop);
-					}
-				}
-				//If the jobID isnt entered
-				else 
-				{
-					printf("Please enter a job ID to stop");
-				}
-				break;
-			}
-		
+		if (s->fd == -1)
+		{
+			//the last line may lack a newline, and a mapping has no room for a NUL
+			if (s->pos == s->len)
+				return NULL;
+			free(s->tail);
+			s->tail = strndup(start, s->len - s->pos);
+			s->pos = s->len;
+			if (s->seek_fd != -1)
+				lseek(s->seek_fd, s->pos, SEEK_SET);
+			return s->tail;
 		}
+
+		//keep the partial line and read the next block behind it
+		memmove(s->buf, start, s->len - s->pos);
+		s->len -= s->pos;
+		s->pos = 0;
+		if (s->len == s->size)
+		{
+			s->size *= 2;
+			s->buf = realloc(s->buf, s->size);
+			if (s->buf == NULL)
+				esh_sys_fatal_error("realloc: ");
+		}
+
+		size_t room = s->size - s->len;
+		ssize_t n = read(s->fd, s->buf + s->len, room < s->chunk ? room : s->chunk);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			esh_sys_error("read: ");
+		if (n <= 0)
+			s->fd = -1;
+		else
+			s->len += n;
+	}
+}
+
+static void script_close(struct script *s)
+{
+	if (s->size == 0)
+		munmap(s->buf, s->len);
+	else
+		free(s->buf);
+	free(s->tail);
+}
+
+/* Run every line of the script, reaping children in between. */
+static void run_script(struct script *s)
+{
+	char *cmdline;
+	while ((cmdline = script_next_line(s)) != NULL)
+	{
+		//the lines are in the script's buffer; plugins that may replace
+		//a line get a copy of it
+		if (esh_hooks.process_raw_cmdline[0] != NULL)
+		{
+			char *copy = strdup(cmdline);
+			if (copy == NULL)
+				esh_sys_fatal_error("strdup: ");
+			run_command_line(&copy);
+			free(copy);
+		}
+		else
+			run_command_line(&cmdline);
+		//go on after whatever the command read of a shared standard input
+		if (s->seek_fd != -1)
+		{
+			off_t at = lseek(s->seek_fd, 0, SEEK_CUR);
+			if (at > (off_t) s->pos && at <= (off_t) s->len)
+				s->pos = at;
+		}
+		handle_child_events();
+		free_finished_jobs();
+	}
+	script_close(s);
+
+	//jobs still queued are started as they are admitted
+	struct pollfd pfd = { .fd = childEventsFD, .events = POLLIN };
+	while (have_queued_jobs())
+	{
+		if (poll(&pfd, 1, QUEUE_POLL_MS) == -1 && errno != EINTR)
+			esh_sys_fatal_error("poll: ");
+		handle_child_events();
+	}
+}
+
+int main(int ac, char *av[])
+{
+	int opt;
+	list_init(&esh_plugin_list);
+	//set up the job registry for later use
+	esh_jobs_init();
+	list_init(&job_history);
+	sigchldFD = esh_signal_fd(SIGCHLD);
+	childEventsFD = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if (childEventsFD == -1 || epoll_ctl(childEventsFD, EPOLL_CTL_ADD, sigchldFD, &ev) == -1)
+		esh_sys_fatal_error("epoll: ");
+	//need this to give control of terminal back to shell
+	shellPID = getpid();
+	//printf("%d", shellPID);
+	/* Process command-line arguments. See getopt(3) */
+	//plugins are loaded after the options are processed, so that the fork
+	//server can be started while the shell is still small
+	char **pluginDirs = calloc(ac, sizeof *pluginDirs);
+	int numPluginDirs = 0;
+	char *batchCommand = NULL;
+	int jobserverSlots = 0;
+	char *cgroupDir = NULL;
+	while ((opt = getopt(ac, av, "hp:e:c:j:g:")) > 0)
+	{
+		switch (opt)
+		{
+		case 'h':
+			usage(av[0]);
+		break;
+
+		case 'p':
+			pluginDirs[numPluginDirs++] = optarg;
+            	break;
+
+		case 'e':
+			if (!esh_launch_set_engine(optarg))
+				usage(av[0]);
+			break;
+
+		case 'c':
+			batchCommand = optarg;
+			break;
+
+		case 'j':
+			jobserverSlots = atoi(optarg);
+			if (jobserverSlots < 1)
+				usage(av[0]);
+			break;
+
+		case 'g':
+			cgroupDir = optarg;
+			break;
+        	}
+    	}	
+
+	//a command, a script, or input that is not a terminal all mean batch mode
+	struct script script;
+	bool batch = true;
+	if (batchCommand != NULL)
+		script_open_string(&script, batchCommand);
+	else if (optind < ac)
+	{
+		int fd = open(av[optind], O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			esh_sys_fatal_error("%s: ", av[optind]);
+		script_open_fd(&script, fd);
+		//a mapped script does not need the descriptor anymore
+		if (script.fd == -1)
+			close(fd);
+	}
+	else if (!isatty(0))
+		script_open_stdin(&script);
+	else
+		batch = false;
+
+	//an interactive shell runs in its own process group, which owns the terminal
+	if (!batch)
+		setpgid(0,0);
+
+	esh_sched_init();
+
+	//the jobserver comes first, so that the fork server and the commands it
+	//starts inherit its descriptors and $MAKEFLAGS
+	if (jobserverSlots > 0 ? esh_jobserver_create(jobserverSlots) : esh_jobserver_join())
+		atexit(release_job_tokens);
+
+	if (cgroupDir != NULL && !esh_cgroup_init(cgroupDir))
+		fprintf(stderr, "esh: jobs are not placed in cgroups\n");
+
+	if (esh_launch_engine == ESH_ENGINE_SERVER && !esh_forkserver_start())
+		esh_launch_engine = ESH_ENGINE_SPAWN;
+
+	//tracing starts after the fork server, which should not carry the trace buffer
+	esh_trace_init();
+
+	for (int i = 0; i < numPluginDirs; i++)
+		esh_plugin_load_from_directory(pluginDirs[i]);
+	free(pluginDirs);
+	
+	esh_plugin_initialize(&shell);
+
+	if (batch)
+	{
+		run_script(&script);
+		return 0;
+	}
+
+	//need to initialize the terminal state
+	tty = esh_sys_tty_init();
+	esh_history_init();
+
+	//a plugin may have replaced readline, which cannot be driven by the event loop
+	if (shell.readline == readline)
+	{
+		event_loop();
+		return 0;
+	}
+
+	/* Read/eval loop. */
+	for (;;)
+	{
+        	/* Do not output a prompt unless shell's stdin is a terminal */
+        	char * prompt = isatty(0) ? shell.build_prompt() : NULL;
+        	char * cmdline = shell.readline(prompt);
+        	free (prompt);
+
+        	if (cmdline == NULL)  /* User typed EOF */
+            		break;
+
+        	esh_history_add(cmdline);
+        	run_command_line(&cmdline);
+        	free (cmdline);
+        	//children that changed state while we were reading
+        	handle_child_events();
+        	free_finished_jobs();
+	}
+	return 0;
+}
+
+enum {READ = 0, WRITE = 1};
+
+static void execPipeline(struct esh_pipeline *eshPipe, pid_t shellPID);
+
+/**
+ * Returns the pipe capacity requested through $ESH_PIPE_SIZE, in bytes.
+ * A 'k' or 'm' suffix multiplies by 1024 or 1024*1024.
+ * Returns 0, meaning the kernel default, if it is not set or not valid.
+ **/
+static int default_pipe_size(void)
+{
+	char *env = getenv("ESH_PIPE_SIZE");
+	if (env == NULL)
+		return 0;
+
+	char *end;
+	long size = strtol(env, &end, 10);
+	if (*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if (*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return (size > 0 && size <= (1 << 30)) ? size : 0;
+}
+
+/**
+ * Returns true if $ESH_PIPESTAT asks for a meter on every pipe between
+ * two commands, that is, if it is set to anything but "" or "0".
+ **/
+static bool pipestat_enabled(void)
+{
+	char *env = getenv("ESH_PIPESTAT");
+	return env != NULL && *env != '\0' && strcmp(env, "0") != 0;
+}
+
+/* A command of a timed or traced pipeline whose exec the shell waits for */
+struct exec_wait {
+	int fd;                     /* read end of its exec pipe */
+	struct esh_command *cmd;
+};
+
+/* Record the exec of each command in w whose exec pipe reports EOF,
+ * waiting up to timeout milliseconds for one to (-1 for as long as it
+ * takes).  A command closes its end of the exec pipe when it execs, or
+ * exits without doing so.  Returns the number of commands still waited
+ * for, which are moved to the front of w. */
+static int check_exec(struct exec_wait *w, int n, int timeout)
+{
+	if (n == 0)
+		return 0;
+	struct pollfd pfds[n];
+	for (int i = 0; i < n; i++)
+		pfds[i] = (struct pollfd) { .fd = w[i].fd, .events = POLLIN };
+
+	if (poll(pfds, n, timeout) == -1)
+	{
+		if (errno != EINTR)
+			esh_sys_fatal_error("poll: ");
+		return n;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int left = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (pfds[i].revents == 0)
+		{
+			w[left++] = w[i];
+			continue;
+		}
+		record_exec(w[i].cmd, &now);
+		close(w[i].fd);
+	}
+	return left;
+}
+
+/**
+ * Runs every pipeline of the command line in order.
+ * Background pipelines are launched back to back without waiting on each
+ * other, so 'a & b & c' starts all three jobs at once, while a foreground
+ * pipeline is waited for before the next one starts, as in 'x; y'.
+ **/
+void execCmd(struct esh_command_line *cline, pid_t shellPID)
+{
+	struct timespec parsed;
+	clock_gettime(CLOCK_MONOTONIC, &parsed);
+
+	struct list_elem *e;
+	for (iterator(e, &cline->pipes))
+	{
+		struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
+		//the time the shell spent parsing is reported by 'time'
+		pipe->parse_started = cline->parse_started;
+		pipe->parsed = parsed;
+		execPipeline(pipe, shellPID);
+	}
+	esh_command_line_free(cline);
+}
+
+/**
+ * Runs a single pipeline, either as a built in command or as a new job.
+ * The pipeline stays part of the command line; jobs get their own copy.
+ **/
+static void execPipeline(struct esh_pipeline *eshPipe, pid_t shellPID)
+{
+/****If looping thru commands in different, dont use same list elem, make new one. warns in slides to do so ****/
+	/*need to split cline into its components to get argv later
+	 *need to check plugins 
+     *handle built in commands
+     *separate pipe from cline to add jobs to list (like in slides)
+     *save the shell state
+	 *create the pipes
+	 *block sigchild while running the child process
+	 *check bg job, else give terminal access
+	 *check io redirect
+	 *execute the command with error checking
+	 *handle parent stuff
+	 *make sure both ends of pipe are closed if not at begin
+	 *set next pipes if not at end of list
+	 *if at end of list close all pipes
+	 *if it is a backgroind job, set current as bg
+	 *if not, need to wait for job
+	 *unblock sigchild
+	 */
+	
+	clock_gettime(CLOCK_MONOTONIC, &eshPipe->started);
+
+	//plugins get to see, change or take over the pipeline first
+	uint64_t t = esh_trace_now();
+	bool consumed = esh_plugin_process_pipeline(eshPipe);
+	esh_trace_complete("hook process_pipeline", t, 0, NULL);
+	if (consumed)
+		return;
+
+	//retrieving data out of the pipeline
+	struct esh_command *cmds = list_entry(list_begin(&eshPipe->commands), struct esh_command, elem);
+
+	//a pipeline prefixed with 'time' reports its latencies and resources once
+	//it finishes.  It always runs as processes, so it has something to report.
+	if (!eshPipe->timed)
+	{
+		//first element of argv may be a built in command, which runs in the shell itself
+		//the registry holds the core built ins and those plugins registered, such as cd
+		const struct esh_builtin *builtin = esh_builtin_lookup(cmds->argv[0]);
+		if (builtin != NULL && builtin->run(cmds))
+			return;
+		//plugins that did not say which built ins they provide get to look at every command
+		if (esh_plugin_process_builtin(cmds))
+			return;
+	}
+
+	//a background job is queued, and starts once the scheduler admits it
+	//and it gets a jobserver slot, if there is a jobserver.  Jobs queued
+	//before it, or with a higher priority, go first.
+	if (eshPipe->bg_job)
+	{
+		eshPipe = queue_job(eshPipe);
+		eshPipe->notify = tty != NULL;
+		start_queued_jobs();
+		if (eshPipe->status == QUEUED && tty != NULL)
+			printf("[%d] queued\n", eshPipe->jid);
+		else if (eshPipe->alive > 0 && tty != NULL)
+			printf("[%d] %d\n", eshPipe->jid, eshPipe->pgrp);
+		return;
+	}
+
+	eshPipe = start_job(eshPipe, -1);
+	//1. wait for the job to terminate
+	wait_for_job(eshPipe);
+	//2. give the terminal back to the shell
+	give_terminal_to(shellPID, tty);
+}
+
+/**
+ * Adds a copy of a pipeline to the job registry, without starting it,
+ * and returns the job.
+ **/
+static struct esh_pipeline *add_job(struct esh_pipeline *eshPipe)
+{
+	//a job outlives the command line, so it gets a compact copy of the pipeline
+	eshPipe = esh_pipeline_copy_out(eshPipe);
+	if (eshPipe == NULL)
+		esh_sys_fatal_error("malloc: ");
+	//adding jobs to the registry, which gives the pipeline its job id
+	//the process group id is set once the first command is started
+	esh_jobs_add(eshPipe);
+	return eshPipe;
+}
+
+/**
+ * Adds a pipeline as a job that waits to be admitted.
+ **/
+static struct esh_pipeline *queue_job(struct esh_pipeline *eshPipe)
+{
+	eshPipe = add_job(eshPipe);
+	eshPipe->status = QUEUED;
+	return eshPipe;
+}
+
+/* Background jobs that outlive the shell are no longer its business;
+ * give their jobserver slots back so that make does not lose them. */
+static void release_job_tokens(void)
+{
+	struct list_elem *e;
+	for (iterator(e, esh_jobs_list()))
+	{
+		struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+		if (job->token != -1)
+		{
+			esh_jobserver_release(job->token);
+			job->token = -1;
+		}
+	}
+}
+
+static bool have_queued_jobs(void)
+{
+	struct list_elem *e;
+	for (iterator(e, esh_jobs_list()))
+		if (list_entry(e, struct esh_pipeline, elem)->status == QUEUED)
+			return true;
+	return false;
+}
+
+/**
+ * Gives back the jobserver slot, the cgroup and the meters of a job whose
+ * processes are all gone.
+ **/
+static void release_job(struct esh_pipeline *eshPipe)
+{
+	if (eshPipe->token != -1)
+	{
+		esh_jobserver_release(eshPipe->token);
+		eshPipe->token = -1;
+	}
+	if (eshPipe->cgroup_fd != -1)
+	{
+		esh_cgroup_remove(eshPipe->cgroup, eshPipe->cgroup_fd);
+		eshPipe->cgroup_fd = -1;
+	}
+	if (eshPipe->meters != NULL)
+	{
+		esh_relay_stats_free(eshPipe->meters, eshPipe->nmeters);
+		eshPipe->meters = NULL;
+	}
+}
+
+/* Return the number of jobs whose processes are running. */
+static int count_running_jobs(void)
+{
+	struct list_elem *e;
+	int n = 0;
+	for (iterator(e, esh_jobs_list()))
+	{
+		struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+		if (job->alive > 0 && (job->status == FOREGROUND || job->status == BACKGROUND))
+			n++;
+	}
+	return n;
+}
+
+/* Return the queued job to admit next: the one with the highest
+ * priority, and the oldest among those.  NULL if there is none. */
+static struct esh_pipeline *next_queued_job(void)
+{
+	struct list_elem *e;
+	struct esh_pipeline *next = NULL;
+	for (iterator(e, esh_jobs_list()))
+	{
+		struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+		if (job->status == QUEUED && (next == NULL || job->priority > next->priority))
+			next = job;
+	}
+	return next;
+}
+
+/**
+ * Asks the scheduler whether another job may start and, if there is a
+ * jobserver, takes a slot.  Sets *token to the slot, or -1 without a
+ * jobserver, and returns true if the job may start.
+ **/
+static bool admit_job(int *token)
+{
+	*token = -1;
+	if (!esh_sched_admit(count_running_jobs()))
+		return false;
+	if (esh_jobserver_active() && (*token = esh_jobserver_acquire()) == -1)
+		return false;
+	return true;
+}
+
+/**
+ * Starts queued jobs, highest priority first, for as long as they are
+ * admitted.
+ **/
+static void start_queued_jobs(void)
+{
+	struct esh_pipeline *job;
+	int token;
+	while ((job = next_queued_job()) != NULL && admit_job(&token))
+	{
+		job->token = token;
+		//errors starting it are printed above the prompt
+		clear_prompt();
+		//this removes the job again if nothing could be started
+		launch_job(job);
+	}
+}
+
+/**
+ * Starts the processes of a pipeline as a new job holding jobserver
+ * token 'token' (or -1), and returns the job, which is a copy of the
+ * pipeline.  If none of its commands could be started, the job has
+ * already been removed again and has no processes.
+ **/
+static struct esh_pipeline *start_job(struct esh_pipeline *eshPipe, int token)
+{
+	eshPipe = add_job(eshPipe);
+	eshPipe->token = token;
+	launch_job(eshPipe);
+	return eshPipe;
+}
+
+/**
+ * Returns the process group the next process of a job joins: the job's,
+ * or 0 for its first process, which leads a new one.  Batch mode has no
+ * job control, so there every process stays in the shell's process group,
+ * where it may read the terminal and gets the ^C typed at it.
+ **/
+static pid_t job_pgrp(struct esh_pipeline *eshPipe)
+{
+	if (tty == NULL)
+		return getpgrp();
+	return eshPipe->pgrp == -1 ? 0 : eshPipe->pgrp;
+}
+
+/**
+ * Sends sig to the processes of a job: to its process group or, in batch
+ * mode, where the job shares the shell's, to each process.  Returns -1 if
+ * it could not be sent.
+ **/
+static int signal_job(struct esh_pipeline *eshPipe, int sig)
+{
+	if (tty != NULL)
+		return kill(-eshPipe->pgrp, sig);
+
+	struct list_elem *e;
+	int rc = -1;
+	for (iterator(e, &eshPipe->commands))
+	{
+		struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+		if (cmd->pid > 0 && kill(cmd->pid, sig) == 0)
+			rc = 0;
+	}
+	return rc;
+}
+
+/**
+ * Starts the relay of a '|+' fan-out, which reads from 'in' and writes
+ * into a new pipe for each consumer.  Sets branchRead[n] to the read end
+ * of the pipe of the nth consumer.
+ **/
+static pid_t start_relay(struct esh_pipeline *eshPipe, int in, int *branchRead)
+{
+	int outs[eshPipe->branches];
+	for (int i = 0; i < eshPipe->branches; i++)
+	{
+		int fds[2];
+		if (esh_launch_pipe(fds, eshPipe->pipe_size) == -1)
+			esh_sys_fatal_error("pipe2: ");
+		branchRead[i + 1] = fds[READ];
+		outs[i] = fds[WRITE];
+	}
+	pid_t child = esh_relay_start(in, outs, eshPipe->branches,
+		job_pgrp(eshPipe), eshPipe->cgroup_fd);
+	//only the relay writes into the consumers' pipes
+	for (int i = 0; i < eshPipe->branches; i++)
+		close(outs[i]);
+	return child;
+}
+
+/**
+ * Starts the meter on the pipe that cmd writes into, which reads from 'in'
+ * and writes into a new pipe.  Returns the read end of that pipe, or 'in'
+ * if the meter could not be started.
+ **/
+static int start_meter(struct esh_pipeline *eshPipe, int in, struct esh_command *cmd)
+{
+	int fds[2];
+	if (esh_launch_pipe(fds, eshPipe->pipe_size) == -1)
+		esh_sys_fatal_error("pipe2: ");
+	uint64_t t = esh_trace_now();
+	pid_t child = esh_relay_meter(in, fds[WRITE], job_pgrp(eshPipe),
+		eshPipe->cgroup_fd, &eshPipe->meters[cmd->meter]);
+	esh_trace_complete("fork", t, 0, "pipestat");
+	close(fds[WRITE]);
+	if (child == -1)
+	{
+		esh_sys_error("pipestat: ");
+		close(fds[READ]);
+		cmd->meter = -1;
+		return in;
+	}
+	//only the meter reads what cmd writes
+	close(in);
+	return fds[READ];
+}
+
+/**
+ * Starts the processes of a job that is in the job registry.
+ **/
+static void launch_job(struct esh_pipeline *eshPipe)
+{
+	pid_t child;
+	bool isBG;
+	uint64_t t;
+
+	//Save the current terminal state if we need to suspend a job
+	if (tty != NULL)
+		esh_sys_tty_save(&eshPipe->saved_tty_state);
+	//Get the esh_pipeline struct type
+	//Set process pipeline to true if the list size is greater than 1. i.e. has more than 1 command
+	
+	//pipes between commands use the pipeline's capacity, unless a plugin set one
+	if (eshPipe->pipe_size == 0)
+		eshPipe->pipe_size = default_pipe_size();
+	//output the shell printed so far must come before the job's output,
+	//also when stdout is not a terminal and thus not line buffered
+	fflush(stdout);
+	//the read end of the pipe the previous command writes into, -1 for the first command
+	int prevRead = -1;
+	//with a '|+' fan-out, the read end of the pipe the relay writes into for
+	//each consumer, and the consumer whose commands are being started
+	int branchRead[eshPipe->branches + 1];
+	int currBranch = 0;
+	//with $ESH_PIPESTAT, a meter goes on each pipe between two commands; it
+	//is started once the command after the pipe is about to be, so that it
+	//can join the job's process group.  'metered' is the command whose pipe
+	//still needs its meter.
+	if (pipestat_enabled() && eshPipe->meters == NULL)
+	{
+		//every chain of commands, before '|+' and in each consumer, has
+		//one command less than it has pipes
+		int n = list_size(&eshPipe->commands) - 1 - eshPipe->branches;
+		if (n > 0 && (eshPipe->meters = esh_relay_stats_create(n)) != NULL)
+			eshPipe->nmeters = n;
+	}
+	struct esh_command *metered = NULL;
+	int nextMeter = 0;
+	//for a timed or traced pipeline, the read end of each command's exec pipe
+	struct exec_wait execWait[list_size(&eshPipe->commands)];
+	int nExecWait = 0;
+	//when the launch engine returned
+	struct timespec returned;
+	isBG = eshPipe->bg_job;
+	//with -g, the job's commands, and all they start, run in a cgroup of its own
+	if (esh_cgroup_enabled() && eshPipe->cgroup_fd == -1)
+		eshPipe->cgroup_fd = esh_cgroup_create(isBG, &eshPipe->cgroup);
+	//book, pg 779 has logic for blocking and unblocking
+	//SIGCHLD stays blocked and is only picked up through sigchldFD, so
+	//children are never reaped before they are added to the job registry
+	//loop through the list of commands and launch them
+	//Get the first pipe element
+	struct list_elem *pipeElem;
+	for(pipeElem = list_begin(&eshPipe->commands); pipeElem != list_end(&eshPipe->commands); )
+	{
+		struct esh_command *currCommand = list_entry(pipeElem, struct esh_command, elem);
+		//the relay ends the commands before a '|+', and each consumer's
+		//commands end where the next consumer's begin
+		struct list_elem *nextElem = list_next(pipeElem);
+		bool isLast = nextElem == list_end(&eshPipe->commands)
+			|| list_entry(nextElem, struct esh_command, elem)->branch != currCommand->branch;
+		//the first command of a consumer reads from the relay
+		if (currCommand->branch != currBranch)
+		{
+			currBranch = currCommand->branch;
+			prevRead = branchRead[currBranch];
+		}
+		if (metered != NULL)
+		{
+			prevRead = start_meter(eshPipe, prevRead, metered);
+			metered = NULL;
+		}
+		//When handling piping there are 3 major cases:
+		//the commands within the pipe are either at: the beginnig, the middle or the end
+		//Every command but the last one writes into a new pipe that the next command reads
+		int nextPipe[2] = {-1, -1};
+		if (!isLast && esh_launch_pipe(nextPipe, eshPipe->pipe_size) == -1)
+			esh_sys_fatal_error("pipe2: ");
+		if (!isLast && eshPipe->meters != NULL)
+		{
+			currCommand->meter = nextMeter++;
+			metered = currCommand;
+		}
+
+		//describe the command for the launch engine: process group, terminal
+		//access, pipe ends and io redirection are all applied in the child
+		struct esh_launch launch;
+		esh_launch_init(&launch, currCommand->argv, job_pgrp(eshPipe),
+			!isBG && tty != NULL);
+		launch.cgroup_fd = eshPipe->cgroup_fd;
+		if (prevRead != -1)
+			esh_launch_dup(&launch, prevRead, 0);
+		if (nextPipe[WRITE] != -1)
+			esh_launch_dup(&launch, nextPipe[WRITE], 1);
+		//the command's redirections come after the pipes, in the order typed;
+		//the shell opens their files, and does not start the command if one
+		//cannot be opened
+		struct esh_redirect_fds redirectFds;
+		bool redirected = esh_redirect_open(currCommand, &launch, &redirectFds);
+
+		//look the command up in the resolved-command cache, so the child can exec
+		//it directly; if it is not found there is no need to start a process
+		launch.path = currCommand->relay ? NULL : esh_path_lookup(currCommand->argv[0]);
+		//the child holds the write end of the exec pipe until it execs
+		int execPipe[2] = {-1, -1};
+		if ((eshPipe->timed || esh_trace_enabled) && launch.path != NULL
+			&& esh_launch_pipe(execPipe, 0) == 0)
+			launch.exec_fd = execPipe[WRITE];
+		clock_gettime(CLOCK_MONOTONIC, &currCommand->started);
+		if (!redirected)
+		{
+			child = -1;
+		}
+		else if (currCommand->relay)
+		{
+			t = esh_trace_now();
+			child = start_relay(eshPipe, prevRead, branchRead);
+			esh_trace_complete("fork", t, 0, currCommand->argv[0]);
+			//the relay runs shell code, it has nothing to exec
+			currCommand->execed = currCommand->started;
+		}
+		else if (launch.path == NULL)
+		{
+			errno = ENOENT;
+			child = -1;
+		}
+		else
+		{
+			t = esh_trace_now();
+			child = esh_launch(&launch);
+			clock_gettime(CLOCK_MONOTONIC, &returned);
+			esh_trace_complete("fork", t, 0, currCommand->argv[0]);
+		}
+
+		//The parent never uses the pipe ends and files it handed to this command,
+		//so close them right away: only the read end for the next command stays open
+		if (redirected)
+			esh_redirect_close(&redirectFds);
+		if (prevRead != -1)
+			close(prevRead);
+		if (nextPipe[WRITE] != -1)
+			close(nextPipe[WRITE]);
+		prevRead = nextPipe[READ];
+		if (execPipe[WRITE] != -1)
+			close(execPipe[WRITE]);
+		if (execPipe[READ] != -1 && (child < 0 || launch.execed))
+		{
+			close(execPipe[READ]);
+			execPipe[READ] = -1;
+		}
+
+		pipeElem = list_next(pipeElem);
+		if (child < 0)
+		{
+			//the command could not be started, so it is not part of the job
+			if (redirected)
+				esh_sys_error("%s: Could not find command: ", currCommand->argv[0]);
+			list_remove(&currCommand->elem);
+			continue;
+		}
+		//update the child pgrp
+		currCommand->pid = child;
+		esh_trace_name_track(child, currCommand->argv[0]);
+		esh_jobs_add_command(currCommand);
+		eshPipe->alive++;
+		//in batch mode the job has no group of its own, but its first
+		//process still identifies it
+		if(eshPipe->pgrp == -1)
+		{
+			eshPipe->pgrp = child;
+			esh_jobs_set_pgrp(eshPipe);
+		}
+		eshPipe->status = isBG ? BACKGROUND : FOREGROUND;
+
+		//posix_spawn only returns once the command exec'd; with the other
+		//engines, the exec pipe reports it, which the shell checks for
+		//after each launch, so that the time is close to the real one
+		if (launch.execed && (eshPipe->timed || esh_trace_enabled))
+			record_exec(currCommand, &returned);
+		else if (execPipe[READ] != -1)
+			execWait[nExecWait++] = (struct exec_wait) { execPipe[READ], currCommand };
+		nExecWait = check_exec(execWait, nExecWait, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &eshPipe->launched);
+	//the shell does not wait for the others: a command may block before
+	//it execs, such as on opening a FIFO whose writer is started later
+	for (int i = 0; i < nExecWait; i++)
+		watch_exec(execWait[i].cmd, execWait[i].fd);
+
+	if(eshPipe->alive == 0)
+	{
+		//nothing was started
+		release_job(eshPipe);
+		esh_jobs_remove(eshPipe);
+	}
+	else
+	{
+		t = esh_trace_now();
+		esh_plugin_pipeline_forked(eshPipe);
+		esh_trace_complete("hook pipeline_forked", t, 0, NULL);
 	}
 }
@@ -11,6 +11,8 @@
 #include <obstack.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "list.h"
 
 #if __STDC_VERSION__ < 201112L
@@ -24,6 +26,7 @@
 struct esh_command;
 struct esh_pipeline;
 struct esh_command_line;
+struct esh_relay_stats;
 
 /*
  * A esh_shell object allows plugins to access services and information. 
@@ -51,6 +54,12 @@ struct esh_shell {
 
     /* Parse command line */
     struct esh_command_line * (* parse_command_line) (char *);
+
+    /* Register a built-in command, typically from a plugin's init().
+     * run() is called for commands named name, and returns true if
+     * it handled the command.  Returns false if name is taken. */
+    bool (* register_builtin) (const char *name,
+                               bool (* run)(struct esh_command *));
 };
 
 /* 
@@ -75,8 +84,10 @@ struct esh_plugin {
      * true - indicates processing should stop.
      * false - indicates processing should continue.
      */
-    /* The command line the user entered.
-     * A plugin may change it. */
+    /* The command line the user entered, a string from malloc().
+     * A plugin may change it in place, or free() it and store another
+     * string from malloc() in its place.  The shell frees the string
+     * it finds there once the line has run. */
     bool (* process_raw_cmdline)(char **);
 
     /* A given pipeline of commands 
@@ -109,6 +120,15 @@ struct esh_plugin {
     bool (* command_status_change)(struct esh_command *, int waitstatus);
 
     /* Add additional fields here if needed. */
+
+    /* NULL-terminated names of the built-ins process_builtin implements.
+     * If set, process_builtin is called only for commands with one of
+     * these names.  If NULL, it is offered every command. */
+    const char **builtins;
+
+    /* All processes of a pipeline have terminated.  The resources
+     * they used are in the pipeline's and commands' rusage fields. */
+    void (* pipeline_finished)(struct esh_pipeline *);
 };
 
 /* A command line may contain multiple pipelines. */
@@ -116,6 +136,9 @@ struct esh_command_line {
     struct list/* <esh_pipeline> */ pipes;        /* List of pipelines */
 
     /* Add additional fields here if needed. */
+    struct obstack arena;    /* All pipelines, commands and words of this
+                                command line are allocated here. */
+    struct timespec parse_started; /* CLOCK_MONOTONIC when parsing began */
 };
 
 enum job_status  { 
@@ -125,6 +148,9 @@ enum job_status  {
     STOPPED,        /* job is stopped via SIGSTOP */
     NEEDSTERMINAL,  /* job is stopped because it was a background job
                        and requires exclusive terminal access */
+    QUEUED,         /* background job waiting to be admitted by the
+                       scheduler (esh-sched.h) or for a jobserver slot;
+                       none of its processes have been started */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -147,6 +173,57 @@ struct esh_pipeline {
                                         stopped after having been in foreground */
 
     /* Add additional fields here if needed. */
+    struct list_elem pgrp_elem;      /* Link element for job registry's pgrp index. */
+    int pipe_size;           /* Capacity of the pipes between commands in bytes,
+                                0 for the default.  Taken from $ESH_PIPE_SIZE
+                                unless a plugin sets it in process_pipeline. */
+    int alive;               /* Number of commands that have not terminated.
+                                Terminated commands stay in 'commands'. */
+    int token;               /* Jobserver token the job holds, or -1 */
+    int priority;            /* Queued jobs with a higher priority are
+                                admitted first; 0 by default */
+    int cgroup;              /* Number of the job's cgroup (esh-cgroup.h), */
+    int cgroup_fd;           /* and its directory, or -1 if it has none */
+    int branches;            /* Number of consumers after '|+', 0 if the
+                                pipeline has no fan-out */
+    struct esh_relay_stats *meters; /* One per pipe between two commands
+                                with $ESH_PIPESTAT set (esh-relay.h), */
+    int nmeters;             /* and their number; NULL and 0 otherwise */
+    bool timed;              /* Prefixed with 'time': report latencies and
+                                resource usage when done */
+    bool notify;             /* Background job whose start was reported;
+                                its end is reported as well */
+    struct timespec parse_started; /* CLOCK_MONOTONIC when the command line
+                                was handed to the parser, */
+    struct timespec parsed;  /* when execCmd received it, */
+    struct timespec started; /* when the shell began to start the job, */
+    struct timespec launched;/* when its last command was launched, */
+    struct timespec finished;/* and when its last command was reaped */
+    struct rusage rusage;    /* Sum over all commands, except for ru_maxrss,
+                                which is the largest of any command */
+};
+
+/* Most redirections a command may have */
+#define ESH_MAX_REDIRECTS 8
+
+enum esh_redirect_op {
+    ESH_REDIRECT_INPUT,      /* n<file, n defaults to 0 */
+    ESH_REDIRECT_OUTPUT,     /* n>file, n defaults to 1 */
+    ESH_REDIRECT_APPEND,     /* n>>file */
+    ESH_REDIRECT_DUP,        /* n>&m or n<&m: n becomes a copy of m */
+    ESH_REDIRECT_CLOSE,      /* n>&- or n<&- */
+};
+
+/* A redirection of one of a command's descriptors.  They are applied
+ * in the order they were typed, after the pipes, so '>f 2>&1' sends
+ * stdout and stderr to f, but '2>&1 >f' sends stderr to where stdout
+ * went before.  '&>f' is short for '>f 2>&1'. */
+struct esh_redirect {
+    enum esh_redirect_op op;
+    int fd;                  /* The command's descriptor */
+    int srcfd;               /* ESH_REDIRECT_DUP: the one it copies */
+    char *path;              /* The file, for the others that have one */
+    struct list_elem elem;   /* Link element for the command's list */
 };
 
 /* A command is part of a pipeline. */
@@ -158,6 +235,9 @@ struct esh_command {
     char *iored_output;      /* If non-NULL, command should write to
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
+    struct list/* <esh_redirect> */ redirects;
+                             /* All redirections, in order, including
+                                those that set iored_input and iored_output */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 
     pid_t   pid;             /* Process id. */
@@ -165,59 +245,116 @@ struct esh_command {
                               /* The pipeline of which this job is a part. */
 
     /* Add additional fields here if needed. */
+    struct list_elem pid_elem;  /* Link element for job registry's pid index. */
+    struct timespec started;    /* CLOCK_MONOTONIC when launched, */
+    struct timespec execed;     /* when it exec'd (timed pipelines only), */
+    struct timespec finished;   /* and when reaped; zero while running */
+    struct rusage rusage;       /* Resources used, from wait4(2) */
+    bool relay;                 /* The relay of a '|+' fan-out (esh-relay.h),
+                                   which esh runs itself */
+    int branch;                 /* 0 for the commands before '|+' and the
+                                   relay, n for those of the nth consumer */
+    int meter;                  /* Index in the pipeline's meters of the one
+                                   on the pipe this command writes into, or -1 */
+    int exec_fd;                /* Read end of its exec pipe while the shell
+                                   waits for it to exec, or -1 */
 };
 
 /** ----------------------------------------------------------- */
 
-/* Create new command structure and initialize it */
-struct esh_command * esh_command_create(char ** argv, 
+/* Create new command structure and initialize it.
+ * The command is allocated in cline's arena. */
+struct esh_command * esh_command_create(struct esh_command_line *cline,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output);
 
-/* Create a new pipeline containing only one command */
-struct esh_pipeline * esh_pipeline_create(struct esh_command *cmd);
+/* Append a redirection to cmd, allocated in cline's arena.  A file
+ * redirection of stdin or stdout also sets iored_input or iored_output.
+ * srcfd is only used by ESH_REDIRECT_DUP, path by those with a file. */
+struct esh_redirect * esh_command_add_redirect(struct esh_command_line *cline,
+                   struct esh_command *cmd, enum esh_redirect_op op,
+                   int fd, int srcfd, char *path);
+
+/* Create a new pipeline containing only one command.
+ * The pipeline is allocated in cline's arena. */
+struct esh_pipeline * esh_pipeline_create(struct esh_command_line *cline,
+                   struct esh_command *cmd);
 
 /* Complete a pipe's setup by copying I/O redirection information
  * from first and last command */
 void esh_pipeline_finish(struct esh_pipeline *pipe);
 
-/* Create an empty command line */
+/* Create an empty command line with a new arena */
 struct esh_command_line * esh_command_line_create_empty(void);
 
-/* Create a command line with a single pipeline */
-struct esh_command_line * esh_command_line_create(struct esh_pipeline *pipe);
+/* Copy a pipeline, its commands and all their strings into a single
+ * malloc'd block that does not depend on the command line's arena.
+ * Used for jobs, which outlive the command line they came from. */
+struct esh_pipeline * esh_pipeline_copy_out(struct esh_pipeline *pipe);
 
-/* Deallocation functions */
+/* Deallocation functions.
+ * esh_command_line_free releases the command line's arena, and with it
+ * all of its pipelines and commands.  esh_pipeline_free releases a
+ * pipeline obtained from esh_pipeline_copy_out. */
 void esh_command_line_free(struct esh_command_line *);
 void esh_pipeline_free(struct esh_pipeline *);
-void esh_command_free(struct esh_command *);
 
 /* Print functions */
 void esh_command_print(struct esh_command *cmd);
 void esh_pipeline_print(struct esh_pipeline *pipe);
 void esh_command_line_print(struct esh_command_line *line);
 
-/* Parse a command line.  Implemented in esh-grammar.y */
+/* Parse a command line.  Implemented in esh-grammar.y
+ * Reentrant; may be called from any thread. */
 struct esh_command_line * esh_parse_command_line(char * line);
 
 /* Load plugins from directory dir */
 void esh_plugin_load_from_directory(char *dirname);
 
-/* Initialize loaded plugins */
+/* Initialize loaded plugins and build the hook dispatch tables */
 void esh_plugin_initialize(struct esh_shell *shell);
 
+/*
+ * Hook dispatch tables, built by esh_plugin_initialize.
+ * Each is a NULL-terminated array of the hooks the loaded plugins
+ * implement, in order of increasing rank, so that dispatching an
+ * event does not have to walk esh_plugin_list.
+ */
+struct esh_hooks {
+    bool (** process_raw_cmdline)(char **);
+    bool (** process_pipeline)(struct esh_pipeline *);
+    bool (** process_builtin)(struct esh_command *);   /* no 'builtins' */
+    char * (** make_prompt)(void);
+    void (** pipeline_forked)(struct esh_pipeline *);
+    bool (** command_status_change)(struct esh_command *, int);
+    void (** pipeline_finished)(struct esh_pipeline *);
+};
+extern struct esh_hooks esh_hooks;
+
+/* Dispatch functions.  Those returning bool return true if a plugin
+ * asked for processing to stop. */
+bool esh_plugin_process_raw_cmdline(char **cmdline);
+bool esh_plugin_process_pipeline(struct esh_pipeline *pipe);
+void esh_plugin_pipeline_forked(struct esh_pipeline *pipe);
+void esh_plugin_command_status_change(struct esh_command *cmd, int status);
+void esh_plugin_pipeline_finished(struct esh_pipeline *pipe);
+
+/* Offer cmd to the process_builtin hooks of plugins that do not list
+ * their built-ins; those that do are registered as built-ins by name.
+ * Returns true if a plugin handled cmd. */
+bool esh_plugin_process_builtin(struct esh_command *cmd);
+
 /* List of loaded plugins */
 extern struct list esh_plugin_list;
 
-/*check if built in command*/
-bool isBuiltIn(char** av);
 
 /*Returns the pipe for the jobID*/
 struct esh_pipeline* get_job(int jobID);
 
 /*set child status*/
-void child_status_change(pid_t child, int status);
+void child_status_change(pid_t child, int status, struct rusage *rusage);
 void execCmd(struct esh_command_line *cline, pid_t shellPID);
 
 void handle_fg(int jobID);
@@ -46,5 +46,6 @@ chdir_builtin(struct esh_command *cmd)
 struct esh_plugin esh_module = {
   .rank = 1,
   .init = init_plugin,
-  .process_builtin = chdir_builtin
+  .process_builtin = chdir_builtin,
+  .builtins = (const char *[]) { "cd", NULL }
 };